@@ -46,9 +46,6 @@ local function timer_server()
         end
         players_slice_data = {}
     end
-
-    -- next trigger
-    timer.register(100, timer_server)
 end
 
 
@@ -65,7 +62,7 @@ function M:on_create()
     logf("hub listen: %s:%s", host, port)
 
     -- 2s timer
-    timer.register(100, timer_server)
+    timer.interval(100, timer_server)
 end
 
 
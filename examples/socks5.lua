@@ -129,44 +129,15 @@ local function resovle(id)
         proxy_port) -- use default ip and port
     socket.send(id, s)
 
-    local client_host, client_port = socket.addrinfo(id)
-    local addrinfo_map = {
-        [proxy_id] = {
-            host = proxy_host,
-            port = proxy_port,
-        },
-
-        [id] = {
-            host = client_host,
-            port = client_port,
-        }
-    }
-
-    local function pipe(source_id, target_id)
-        while true do
-            local s, err = socket.read(source_id)
-            local addr = addrinfo_map[source_id]
-            if not s then
-                socket.close(target_id)
-                hive.exit()
-                hive_log.logf("[error] %s:%s error:%s",addr.host, addr.port, err)
-                return
-            elseif #s == 0 then
-                hive_log.logf("[break] %s:%s", addr.host, addr.port)
-                socket.close(target_id)
-                hive.exit()
-                return
-            else
-                socket.send(target_id, s)
-            end
-        end        
+    -- the socket thread relay the data of both sides without copy to actor
+    local sent, received, err = socket.relay(id, proxy_id)
+    if sent then
+        hive_log.logf("[close] %s:%s sent:%s received:%s %s",
+            connect_addr, connect_port, sent, received, err or "")
+    else
+        hive_log.logf("[error] %s:%s error:%s", connect_addr, connect_port, err)
     end
-
-    -- proxy to client
-    thread.run(pipe, proxy_id, id)
-
-    -- client to proxy
-    thread.run(pipe, id, proxy_id)
+    hive.exit()
 end
 
 
@@ -57,8 +57,12 @@ local dispatch_driver = {
         check_call(_actor_obj, "on_release", _actor_ud)
     end,
 
-    [HIVE_TTIMER] = function (source, handle, type, session)
-        timer.trigger(session)
+    [HIVE_TTIMER] = function (source, handle, type, session, sessions, counts)
+        if sessions then
+            timer.trigger_list(sessions, counts)
+        else
+            timer.trigger(session)
+        end
     end,
 
     [HIVE_TNORMAL] = function (source, handle, type, session, data)
@@ -79,8 +83,8 @@ local dispatch_driver = {
         end
     end,
 
-    [HIVE_TSOCKET] = function (source, handle, type, id, event_type, data)
-        return socket.dispatch(source, handle, type, id, event_type, data)
+    [HIVE_TSOCKET] = function (source, handle, type, id, event_type, ...)
+        return socket.dispatch(source, handle, type, id, event_type, ...)
     end,
 }
 
@@ -0,0 +1,42 @@
+local c = require "hive.c"
+local timer = require "hive.timer"
+local logf = require("hive.log").logf
+
+local M = {}
+
+local type_order = {"mailbox", "socket", "timer", "lua", "gate", "other"}
+
+
+local function log_snapshot(stat)
+    local t = {}
+    for i, name in ipairs(type_order) do
+        local v = stat[name]
+        t[i] = string.format("%s:%d/%d", name, v.bytes, v.count)
+    end
+    logf("[memstat] %s", table.concat(t, " "))
+end
+
+
+-- return {[type_name] = {bytes = , count = }}
+function M.stat()
+    return c.hive_memstat()
+end
+
+
+-- call `func(stat)` every `interval` timer ticks, default write the snapshot to log
+function M.snapshot(interval, func)
+    func = func or log_snapshot
+    local entry = {}
+    entry.timer_id = timer.interval(interval, function ()
+            func(c.hive_memstat())
+        end)
+    return entry
+end
+
+
+function M.stop(entry)
+    timer.unregister(entry.timer_id)
+end
+
+
+return M
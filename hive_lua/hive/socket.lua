@@ -10,12 +10,34 @@ local SE_BREAK = c.SE_BREAK
 local SE_ACCEPT = c.SE_ACCEPT
 local SE_RECIVE = c.SE_RECIVE
 local SE_ERROR = c.SE_ERROR
+local SE_CONGESTED = c.SE_CONGESTED
+local SE_WRITABLE = c.SE_WRITABLE
+local SE_UDP = c.SE_UDP
+local SE_RELAY_READY = c.SE_RELAY_READY
+local SE_RELAY_END = c.SE_RELAY_END
 
 
 
 local M = {}
 local status_map = {}
 
+
+local function wakeup_writer(entry, ok)
+    local co = entry.writer_co
+    if co then
+        entry.writer_co = nil
+        thread.resume(co, ok)
+    end
+end
+
+local function wakeup_relay(entry, ...)
+    local co = entry and entry.relay_co
+    if co then
+        entry.relay_co = nil
+        thread.resume(co, ...)
+    end
+end
+
 local socket_driver = {
     [SE_CONNECTED] = function (id, data)
         local entry = status_map[id]
@@ -32,13 +54,23 @@ local socket_driver = {
         end
     end,
 
-    [SE_ACCEPT] = function (server_id, client_id)
+    [SE_ACCEPT] = function (server_id, client_ids)
         local entry = status_map[server_id]
         assert(entry.status == "listening")
-        assert(not status_map[client_id])
         local on_accept_func = entry.on_accept
-        if on_accept_func then
-            on_accept_func(client_id)
+        for i=1, #client_ids do
+            local client_id = client_ids[i]
+            assert(not status_map[client_id])
+            -- attached by listen, it is read before on_accept
+            if entry.attach then
+                status_map[client_id] = {
+                    status = "forward",
+                    buffer = new_buffer(),
+                }
+            end
+            if on_accept_func then
+                on_accept_func(client_id)
+            end
         end
     end,
 
@@ -68,15 +100,58 @@ local socket_driver = {
                 entry.status = "forward"
                 thread.resume(co, data)
             end
-        elseif status ~= "forward" then
+        elseif status == "forward" then
+            -- keep it for next read, pause the socket if too much is buffered
+            local buffer = entry.buffer
+            buffer:push(data)
+            local limit = entry.read_limit
+            if limit and not entry.auto_paused and buffer:size() >= limit then
+                entry.auto_paused = true
+                c.hive_socket_pause(id)
+            end
+        else
             local s = string.format("invalid status:%s from socket id:%s", status, id)
             error(s)
         end
     end,
 
+    [SE_CONGESTED] = function (id)
+        local entry = status_map[id]
+        if entry then
+            entry.congested = true
+        end
+    end,
+
+    [SE_WRITABLE] = function (id)
+        local entry = status_map[id]
+        if entry then
+            entry.congested = nil
+            wakeup_writer(entry, true)
+        end
+    end,
+
+    [SE_UDP] = function (id, data, addr)
+        local entry = status_map[id]
+        if entry and entry.on_recv then
+            entry.on_recv(data, addr)
+        end
+    end,
+
+    [SE_RELAY_READY] = function (id)
+        wakeup_relay(status_map[id], "ready")
+    end,
+
+    [SE_RELAY_END] = function (id, sent, received, err)
+        wakeup_relay(status_map[id], "end", sent, received, err)
+    end,
+
     [SE_ERROR] = function (id, data)
         local entry = status_map[id]
         if entry then
+            wakeup_writer(entry, false)
+            if entry.relay_co then
+                return wakeup_relay(entry, "error", nil, nil, data)
+            end
             local status = entry.status
             if status == "receive" then
                 local co = entry.co
@@ -95,6 +170,10 @@ local socket_driver = {
     [SE_BREAK] = function (id)
         local entry = status_map[id]
         if entry then
+            wakeup_writer(entry, false)
+            if entry.relay_co then
+                return wakeup_relay(entry, "error", nil, nil, "relay socket is broken")
+            end
             local status = entry.status
             if status == "receive" then
                 local co = entry.co
@@ -119,10 +198,10 @@ local function check_id(id)
 end
 
 
-function M.dispatch(source, handle, type, id, event_type, data)
+function M.dispatch(source, handle, type, id, event_type, ...)
     local sd_f = socket_driver[event_type]
     if sd_f then
-        sd_f(id, data)
+        sd_f(id, ...)
     else
         local s = string.format("invalid event_type:%s", event_type)
         error(s)
@@ -130,10 +209,12 @@ function M.dispatch(source, handle, type, id, event_type, data)
 end
 
 
-function M.connect(host, port)
-    local id, err = c.hive_socket_connect(host, port)
+local function wait_connect(id, err, opt)
     if id then
         assert(status_map[id] == nil)
+        if opt and opt.timeout then
+            c.hive_socket_timeout(id, opt.timeout)
+        end
         local co, main_thread = thread.running()
         status_map[id] = {
             status = "connecting",
@@ -146,8 +227,7 @@ function M.connect(host, port)
 end
 
 
-function M.listen(host, port, on_accept)
-    local id = c.hive_socket_listen(host, port)
+local function add_listener(id, on_accept, opt)
     if id < 0 then
         local s = string.format("listen errorcode:%s", id)
         return false, s
@@ -156,12 +236,74 @@ function M.listen(host, port, on_accept)
         status_map[id] = {
             status = "listening",
             on_accept = on_accept,
+            attach = opt and opt.attach,
         }
         return id
     end
 end
 
 
+-- opt is the socket options, opt.timeout is ms to fail with "connect timeout"
+function M.connect(host, port, opt)
+    local id, err = c.hive_socket_connect(host, port, opt)
+    return wait_connect(id, err, opt)
+end
+
+
+-- opt is the socket options of listener and accepted sockets.
+-- opt.attach is true, the accepted socket is attached to self without socket.attach
+function M.listen(host, port, on_accept, opt)
+    local id = c.hive_socket_listen(host, port, opt)
+    return add_listener(id, on_accept, opt)
+end
+
+
+-- unix domain socket of path, "@name" is the abstract name on linux
+function M.connect_unix(path, opt)
+    local id, err = c.hive_socket_connect_unix(path, opt)
+    return wait_connect(id, err, opt)
+end
+
+
+function M.listen_unix(path, on_accept, opt)
+    local id = c.hive_socket_listen_unix(path, opt)
+    return add_listener(id, on_accept, opt)
+end
+
+
+-- bind udp host:port, on_recv(data, addr) is called by every datagram
+function M.udp(host, port, on_recv, opt)
+    local id, err = c.hive_socket_udp(host, port, opt)
+    if not id then
+        return false, err
+    end
+    assert(not status_map[id])
+    status_map[id] = {
+        status = "udp",
+        on_recv = on_recv,
+    }
+    return id
+end
+
+
+-- send every string as a datagram to addr
+function M.sendto(id, addr, ...)
+    return c.hive_socket_sendto(id, addr, ...)
+end
+
+
+-- ip and port of addr
+function M.udp_address(addr)
+    return c.hive_socket_udp_address(addr)
+end
+
+
+-- addr of numeric ip and port for sendto
+function M.udp_peer(ip, port)
+    return c.hive_socket_udp_peer(ip, port)
+end
+
+
 function M.read(id, size)
     local entry = check_id(id)
     local status = entry.status
@@ -169,6 +311,12 @@ function M.read(id, size)
     if status == "forward" then
         local buffer = entry.buffer
         local data = buffer:pop(size)
+        if entry.auto_paused and (not data or buffer:size() < entry.read_limit) then
+            entry.auto_paused = nil
+            if not entry.paused then
+                c.hive_socket_resume(id)
+            end
+        end
         if not data then
             entry.status = "receive"
             entry.need_size = size
@@ -180,10 +328,18 @@ function M.read(id, size)
         end
 
     elseif status == "break" then
+        local data = entry.buffer and entry.buffer:pop(size)
+        if data then
+            return data
+        end
         status_map[id] = nil
         return ""
 
     elseif status == "error" then
+        local data = entry.buffer and entry.buffer:pop(size)
+        if data then
+            return data
+        end
         local err = entry.error
         status_map[id] = nil
         return false, err
@@ -199,9 +355,129 @@ function M.send(id, data)
 end
 
 
+-- send all strings as one write
+function M.sendv(id, ...)
+    return c.hive_socket_sendv(id, ...)
+end
+
+
+function M.pause(id)
+    local entry = check_id(id)
+    entry.paused = true
+    return c.hive_socket_pause(id)
+end
+
+
+function M.resume(id)
+    local entry = check_id(id)
+    entry.paused = nil
+    if entry.auto_paused then
+        return 0
+    end
+    return c.hive_socket_resume(id)
+end
+
+
+-- pause the socket when size bytes are received but not read, resume when read below it
+function M.read_limit(id, size)
+    local entry = check_id(id)
+    entry.read_limit = size
+    if not size and entry.auto_paused then
+        entry.auto_paused = nil
+        if not entry.paused then
+            c.hive_socket_resume(id)
+        end
+    end
+end
+
+
+-- SE_CONGESTED is sent when queued bytes reach high, SE_WRITABLE when drop to low
+function M.watermark(id, high, low)
+    return c.hive_socket_watermark(id, high, low)
+end
+
+
+function M.queued(id)
+    return c.hive_socket_queued(id)
+end
+
+
+-- ms of timeouts checked by socket thread, 0 or nil is disable.
+-- read is closed with "read timeout" when nothing is received,
+-- write is closed with "write timeout" when queued data is not written.
+function M.timeout(id, read, write, connect)
+    return c.hive_socket_timeout(id, connect or 0, read or 0, write or 0)
+end
+
+
+local function relay_flush(entry, peer_id)
+    local data = entry.buffer and entry.buffer:pop()
+    if data then
+        c.hive_socket_send(peer_id, data)
+    end
+end
+
+
+-- relay data between id and peer_id in socket thread until both sides are closed,
+-- the data read already but not popped is sent first. both sockets are closed at return.
+-- return bytes sent to peer_id, bytes received from it and the error, or false and the error.
+function M.relay(id, peer_id)
+    local entry = check_id(id)
+    local peer = check_id(peer_id)
+    local ret = c.hive_socket_relay(id, peer_id)
+    if ret ~= 0 then
+        return false, string.format("relay errorcode:%s", ret)
+    end
+
+    -- every data received before ready is in buffer
+    local co = thread.running()
+    entry.relay_co = co
+    peer.relay_co = co
+    local ev, sent, received, err = thread.yield(co)
+    peer.relay_co = nil
+    if ev == "ready" then
+        relay_flush(entry, peer_id)
+        relay_flush(peer, id)
+        entry.relay_co = co
+        c.hive_socket_relay_start(id)
+        ev, sent, received, err = thread.yield(co)
+    end
+
+    entry.relay_co = nil
+    M.close(id)
+    M.close(peer_id)
+    if ev == "end" then
+        return sent, received, err
+    end
+    return false, err
+end
+
+
+-- wait until the congested socket drains to the low watermark,
+-- return false if the socket is broken.
+function M.wait_writable(id)
+    local entry = status_map[id]
+    if not entry then
+        return false
+    end
+    if not entry.congested then
+        return true
+    end
+    assert(not entry.writer_co)
+    local co = thread.running()
+    entry.writer_co = co
+    return thread.yield(co)
+end
+
+
 function M.close(id)
-    c.hive_socket_close(id)
+    local entry = status_map[id]
     status_map[id] = nil
+    c.hive_socket_close(id)
+    if entry then
+        wakeup_writer(entry, false)
+        wakeup_relay(entry, "error", nil, nil, "relay socket is closed")
+    end
 end
 
 
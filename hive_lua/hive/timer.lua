@@ -1,9 +1,12 @@
 local c = require "hive.c"
 local timer_register = c.hive_timer_register
+local timer_interval = c.hive_timer_interval
+local timer_cancel = c.hive_timer_cancel
 
 local M = {}
 
 local timer_map = {}
+local interval_map = {}
 
 function M.register(offset, func)
     local timer_id = timer_register(offset)
@@ -12,16 +15,45 @@ function M.register(offset, func)
 end
 
 
+-- trigger `func(count)` every `interval` ticks until unregister,
+-- count is more than 1 when the ticks are missed
+function M.interval(interval, func)
+    local timer_id = timer_interval(interval)
+    timer_map[timer_id] = func
+    interval_map[timer_id] = true
+    return timer_id
+end
+
+
 function M.unregister(timer_id)
-    timer_map[timer_id] = nil
+    if timer_map[timer_id] then
+        timer_map[timer_id] = nil
+        interval_map[timer_id] = nil
+        timer_cancel(timer_id)
+    end
 end
 
 
-function M.trigger(timer_id)
+function M.trigger(timer_id, count)
     local func = timer_map[timer_id]
     if func then
-        func()
-        timer_map[timer_id] = nil
+        if interval_map[timer_id] then
+            func(count or 1)
+        else
+            func()
+            timer_map[timer_id] = nil
+        end
+    end
+end
+
+
+-- the timer callback error don't break the other expired timers
+function M.trigger_list(list, counts)
+    for i=1,#list do
+        local ok, err = xpcall(M.trigger, debug.traceback, list[i], counts[i])
+        if not ok then
+            c.hive_log(c.HIVE_LOG_ERR, err)
+        end
     end
 end
 
@@ -31,4 +63,10 @@ function M.gettime()
 end
 
 
+-- ms of one timer tick
+function M.tickms()
+    return c.hive_timer_tickms()
+end
+
+
 return M
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "hive.h"
 #include "hive_socket.h"
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_GATE
 #include "hive_memory.h"
 #include "hive_log.h"
 
@@ -126,7 +127,10 @@ _gate_on_control(uint32_t source, int session, void* data, size_t sz) {
             int ret = -100;  // is also bind
             struct bind_info* bind = (struct bind_info*)msg->content.bind_data;
             if(_ENV_GATE.opaque_handle == 0) {
-                int listen_id = hive_socket_listen(bind->ip, bind->port, _ENV_GATE.actor_handle);
+                struct socket_opt opt;
+                memset(&opt, 0, sizeof(opt));
+                opt.attach_handle = _ENV_GATE.actor_handle;
+                int listen_id = hive_socket_listen_opt(bind->ip, bind->port, _ENV_GATE.actor_handle, &opt);
                 if(listen_id >= 0) {
                     _ENV_GATE.opaque_handle = source;
                     _ENV_GATE.listen_id = listen_id;
@@ -178,13 +182,16 @@ _actor_gate_dispatch(uint32_t source, uint32_t self, int type, int session, void
                     hive_send(_ENV_GATE.actor_handle, _ENV_GATE.opaque_handle, HIVE_TNORMAL, 0, &msg, sizeof(msg));
                 } break;
 
+                // the clients are attached to gate by listen
                 case SE_ACCEPT: {
-                    struct gate_msg msg;
-                    msg.gct = GCT_ACCEPT_RESPONSE;
-                    client_id = sdata->u.id;
-                    msg.content.connect_response.accept_id = client_id;
-                    hive_socket_attach(client_id, _ENV_GATE.actor_handle);
-                    hive_send(_ENV_GATE.actor_handle, _ENV_GATE.opaque_handle, HIVE_TNORMAL, 0, &msg, sizeof(msg));
+                    const int* client_ids = (const int*)sdata->data;
+                    size_t i;
+                    for(i=0; i<sdata->u.size; i++) {
+                        struct gate_msg msg;
+                        msg.gct = GCT_ACCEPT_RESPONSE;
+                        msg.content.connect_response.accept_id = client_ids[i];
+                        hive_send(_ENV_GATE.actor_handle, _ENV_GATE.opaque_handle, HIVE_TNORMAL, 0, &msg, sizeof(msg));
+                    }
                 } break;
 
                 case SE_RECIVE: {
@@ -298,8 +305,12 @@ _lmsg_send(lua_State* L) {
     head[1] = sz & 0xff;
     head[0] = (sz >> 8) & 0xff;
 
-    hive_socket_send(client_id, head, 2);
-    hive_socket_send(client_id, s, sz);
+    struct iovec iov[2];
+    iov[0].iov_base = head;
+    iov[0].iov_len = 2;
+    iov[1].iov_base = (void*)s;
+    iov[1].iov_len = sz;
+    hive_socket_sendv(client_id, iov, 2);
     return 0;
 }
 
@@ -1,3 +1,4 @@
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_GATE
 #include "hive_memory.h"
 #include "actor_gate/imap.h"
 #include "actor_gate/servergate.h"
@@ -17,6 +17,11 @@
 
 #define unused(v)  ((void)v)
 
+#define DEFAULT_TIMER_RESOLUTION 10   // 10 ms
+#define DEFAULT_SOCKET_THREAD 1
+#define DEFAULT_SOCKET_MAX 65536
+#define DEFAULT_RESOLVER_THREAD 2
+
 static struct hive_env {
     int thread;
     bool staring;
@@ -26,14 +31,33 @@ static struct hive_env {
 }ENV;
 
 
+// startup config is read from environment variable
+static int
+_env_config(const char* name, int default_value) {
+    const char* s = getenv(name);
+    if(s == NULL || *s == 0) {
+        return default_value;
+    }
+    char* end = NULL;
+    long v = strtol(s, &end, 10);
+    if(*end != 0 || v <= 0) {
+        hive_elog("hive", "invalid config %s=%s, use default value: %d", name, s, default_value);
+        return default_value;
+    }
+    return (int)v;
+}
+
+
 void
 hive_init() {
     hive_actor_init();
     ENV.thread = 4;
     ENV.staring = false;
     ENV.exit = false;
-    ENV.sm_state = socket_mgr_create();
-    ENV.tm_state = hive_timer_create();
+    ENV.sm_state = socket_mgr_create(_env_config("HIVE_SOCKET_THREAD", DEFAULT_SOCKET_THREAD),
+        _env_config("HIVE_SOCKET_MAX", DEFAULT_SOCKET_MAX),
+        _env_config("HIVE_RESOLVER_THREAD", DEFAULT_RESOLVER_THREAD));
+    ENV.tm_state = hive_timer_create(_env_config("HIVE_TIMER_RESOLUTION", DEFAULT_TIMER_RESOLUTION), ENV.thread);
     assert(ENV.sm_state);
 }
 
@@ -42,9 +66,12 @@ void
 hive_exit() {
     ENV.exit = true;
 
-    // notify socket thread exit
+    // notify socket threads exit
     socket_mgr_exit(ENV.sm_state);
 
+    // wake up timer thread
+    hive_timer_wakeup(ENV.tm_state);
+
     // send exit message to all actors
     hive_actor_exit();
 }
@@ -52,9 +79,22 @@ hive_exit() {
 
 static void*
 _thread_socket(void* p) {
+    int thread = (int)(intptr_t)p;
+    for(;;) {
+        int ret = socket_mgr_update(ENV.sm_state, thread);
+        if(ret < 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+static void*
+_thread_resolver(void* p) {
     unused(p);
     for(;;) {
-        int ret = socket_mgr_update(ENV.sm_state);
+        int ret = socket_mgr_resolve(ENV.sm_state);
         if(ret < 0) {
             break;
         }
@@ -68,10 +108,10 @@ _thread_timer(void* p) {
     unused(p);
     for(;;) {
         hive_timer_update(ENV.tm_state);
-        usleep(2500); // 2.5 ms update
         if(ENV.exit) {
             break;
         }
+        hive_timer_wait(ENV.tm_state);
     }
     return NULL;
 }
@@ -101,17 +141,24 @@ _create_thread(pthread_t* thread, void*(*progress)(void*), void* arg) {
 
 int
 hive_start() {
-    pthread_t pid[ENV.thread+2];
+    int socket_thread = socket_mgr_thread_count(ENV.sm_state);
+    int resolver_thread = socket_mgr_resolver_count(ENV.sm_state);
+    pthread_t pid[ENV.thread+socket_thread+resolver_thread+1];
     int len = sizeof(pid)/sizeof(pid[0]);
     if(ENV.staring) {
         hive_printf("hive is running");
         return 1;
     }
 
-    _create_thread(&pid[0], _thread_socket, NULL);
-    _create_thread(&pid[1], _thread_timer, NULL);
     int i=0;
-    for(i=2; i<len; i++) {
+    for(i=0; i<socket_thread; i++) {
+        _create_thread(&pid[i], _thread_socket, (void*)(intptr_t)i);
+    }
+    for(i=socket_thread; i<socket_thread+resolver_thread; i++) {
+        _create_thread(&pid[i], _thread_resolver, NULL);
+    }
+    _create_thread(&pid[i], _thread_timer, NULL);
+    for(i=i+1; i<len; i++) {
         pthread_t* thread = &pid[i];
         _create_thread(thread, _thread_worker, NULL);
     }
@@ -151,17 +198,43 @@ hive_send(uint32_t source, uint32_t target, int type, int session, void* data, s
     return ret == 0;
 }
 
+bool
+hive_send_nocopy(uint32_t source, uint32_t target, int type, int session, void* data, size_t size) {
+    int ret = hive_actor_send_nocopy(source, target, type, session, data, size);
+    return ret == 0;
+}
+
 
 // ---------------- hive socket api ----------------  
 int 
 hive_socket_connect(const char* host, uint16_t port, uint32_t actor_handle, char const** out_error) {
-    int id = socket_mgr_connect(ENV.sm_state, host, port, out_error, actor_handle);
+    int id = socket_mgr_connect(ENV.sm_state, host, port, out_error, actor_handle, NULL);
     return id;
 }
 
+int
+hive_socket_connect_opt(const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt, char const** out_error) {
+    return socket_mgr_connect(ENV.sm_state, host, port, out_error, actor_handle, opt);
+}
+
 int 
 hive_socket_listen(const char* host, uint16_t port, uint32_t actor_handle) {
-    return socket_mgr_listen(ENV.sm_state, host, port, actor_handle);
+    return socket_mgr_listen(ENV.sm_state, host, port, actor_handle, NULL);
+}
+
+int
+hive_socket_listen_opt(const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt) {
+    return socket_mgr_listen(ENV.sm_state, host, port, actor_handle, opt);
+}
+
+int
+hive_socket_connect_unix(const char* path, uint32_t actor_handle, const struct socket_opt* opt, char const** out_error) {
+    return socket_mgr_connect_unix(ENV.sm_state, path, out_error, actor_handle, opt);
+}
+
+int
+hive_socket_listen_unix(const char* path, uint32_t actor_handle, const struct socket_opt* opt) {
+    return socket_mgr_listen_unix(ENV.sm_state, path, actor_handle, opt);
 }
 
 
@@ -170,6 +243,56 @@ hive_socket_send(int id, const void* data, size_t size) {
     return socket_mgr_send(ENV.sm_state, id, data, size);
 }
 
+int
+hive_socket_sendv(int id, const struct iovec* iov, int count) {
+    return socket_mgr_sendv(ENV.sm_state, id, iov, count);
+}
+
+int
+hive_socket_udp(const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt, char const** out_error) {
+    return socket_mgr_udp(ENV.sm_state, host, port, actor_handle, opt, out_error);
+}
+
+int
+hive_socket_sendto(int id, const void* addr, size_t addr_len, const struct iovec* iov, int count) {
+    return socket_mgr_sendto(ENV.sm_state, id, addr, addr_len, iov, count);
+}
+
+int
+hive_socket_watermark(int id, size_t high, size_t low) {
+    return socket_mgr_watermark(ENV.sm_state, id, high, low);
+}
+
+int64_t
+hive_socket_queued(int id) {
+    return socket_mgr_queued(ENV.sm_state, id);
+}
+
+int
+hive_socket_timeout(int id, int connect_ms, int read_ms, int write_ms) {
+    return socket_mgr_timeout(ENV.sm_state, id, connect_ms, read_ms, write_ms);
+}
+
+int
+hive_socket_relay(int id, int peer_id) {
+    return socket_mgr_relay(ENV.sm_state, id, peer_id);
+}
+
+int
+hive_socket_relay_start(int id) {
+    return socket_mgr_relay_start(ENV.sm_state, id);
+}
+
+int
+hive_socket_pause(int id) {
+    return socket_mgr_pause(ENV.sm_state, id);
+}
+
+int
+hive_socket_resume(int id) {
+    return socket_mgr_resume(ENV.sm_state, id);
+}
+
 int
 hive_socket_addrinfo(int id, struct socket_addrinfo* out_addrinfo, const char** out_error) {
     return socket_mgr_addrinfo(ENV.sm_state, id, out_addrinfo, out_error);
@@ -187,7 +310,25 @@ hive_socket_attach(int id, uint32_t actor_handle) {
 
 int
 hive_timer_register(uint32_t offset, uint32_t handle) {
-    return hive_timer_insert(ENV.tm_state, offset, handle);
+    return hive_timer_insert(ENV.tm_state, offset, 0, handle);
+}
+
+int
+hive_timer_interval(uint32_t interval, uint32_t handle) {
+    if(interval == 0) {
+        interval = 1;
+    }
+    return hive_timer_insert(ENV.tm_state, interval, interval, handle);
+}
+
+bool
+hive_timer_cancel(int session, uint32_t handle) {
+    return hive_timer_remove(ENV.tm_state, session, handle);
+}
+
+uint32_t
+hive_timer_tickms() {
+    return hive_timer_resolution(ENV.tm_state);
 }
 
 int 
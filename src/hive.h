@@ -9,6 +9,9 @@
 
 #define HIVE_TCREATE 0
 #define HIVE_TRELEASE 1
+// expired timer message: if data is NULL, session is the timer session expired once.
+// otherwise data is an int array of {session, count} pairs and session is the pair number,
+// count is the expired times of an interval timer, more than 1 when ticks are missed.
 #define HIVE_TTIMER 2
 #define HIVE_TSOCKET 3
 #define HIVE_TNORMAL 4
@@ -24,6 +27,11 @@ typedef void (*hive_actor_cb)(
 uint32_t hive_register(char* name, hive_actor_cb cb, void* ud, void* data, size_t sz);
 bool hive_unregister(uint32_t handle);
 int hive_timer_register(uint32_t offset, uint32_t handle);
+int hive_timer_interval(uint32_t interval, uint32_t handle);
+bool hive_timer_cancel(int session, uint32_t handle);
+uint32_t hive_timer_tickms();
 bool hive_send(uint32_t source, uint32_t target, int type, int session, void* data, size_t size);
+// data must be alloced by hive_malloc, the message own it and free it after dispatch
+bool hive_send_nocopy(uint32_t source, uint32_t target, int type, int session, void* data, size_t size);
 
 #endif
\ No newline at end of file
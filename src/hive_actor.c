@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_MAILBOX
 #include "hive_memory.h"
 #include "spinlock.h"
 #include "rwlock.h"
@@ -304,6 +305,34 @@ hive_actor_send(uint32_t source, uint32_t target, int type, int session, void* d
     return ret;
 }
 
+// the message take data without copy, data is freed even if send failed
+int
+hive_actor_send_nocopy(uint32_t source, uint32_t target, int type, int session, void* data, size_t size) {
+    int ret = 0;
+    actors_rlock();
+    struct hive_actor_context* dst_actor = _actor_query(target);
+    if (dst_actor == NULL) {
+        ret = -1;
+        if(data) {
+            hive_free(data);
+        }
+    } else {
+        struct hive_message msg = {
+            .source = source,
+            .type = type,
+            .session = session,
+            .size = size,
+            .data = (size == 0)?(NULL):(data),
+        };
+        if(size == 0 && data) {
+            hive_free(data);
+        }
+       _actor_send(dst_actor, &msg);
+    }
+    actors_runlock();
+    return ret;
+}
+
 
 
 static struct hive_actor_context*
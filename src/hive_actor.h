@@ -15,6 +15,7 @@ uint32_t hive_actor_create(char* name, hive_actor_cb cb, void* ud, void* data, s
 int hive_actor_release(uint32_t handle);
 
 int hive_actor_send(uint32_t source, uint32_t target, int type, int session, void* data, size_t size);
+int hive_actor_send_nocopy(uint32_t source, uint32_t target, int type, int session, void* data, size_t size);
 int hive_actor_dispatch();
 
 #endif
\ No newline at end of file
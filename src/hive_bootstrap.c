@@ -3,9 +3,14 @@
 #include "hive_socket.h"
 
 #include "actor_log.h"
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_LUA
 #include "hive_memory.h"
 #include "hive_log.h"
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
@@ -47,6 +52,36 @@ traceback(lua_State* L) {
 }
 
 
+// lua state memory is count as HIVE_MEMORY_LUA without the debug tracker
+static void*
+_lua_alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    if(ptr == NULL) {
+        osize = 0;  // osize is object type when ptr is NULL
+    }
+
+    if(nsize == 0) {
+        if(ptr) {
+            free(ptr);
+            hive_memory_account(HIVE_MEMORY_LUA, -(int64_t)osize, -1);
+        }
+        return NULL;
+    }
+
+    void* ret = realloc(ptr, nsize);
+    if(ret) {
+        hive_memory_account(HIVE_MEMORY_LUA, (int64_t)nsize - (int64_t)osize, (ptr)?(0):(1));
+    }
+    return ret;
+}
+
+
+static int
+_lua_panic(lua_State* L) {
+    hive_panic("unprotected error in call to Lua API (%s)", lua_tostring(L, -1));
+    return 0;
+}
+
+
 static void
 reg_lua_lib(lua_State *L, lua_CFunction func, const char * libname) {
     luaL_requiref(L, libname, func, 0);
@@ -114,9 +149,16 @@ _lua_actor_dispatch(uint32_t source, uint32_t self, int type, int session, void*
                 case SE_BREAK:
                     break;
 
+                // push accepted ids table
                 case SE_ACCEPT:{
-                    int client_id = sdata->u.id;
-                    lua_pushinteger(L, client_id);
+                    const int* client_ids = (const int*)sdata->data;
+                    size_t count = sdata->u.size;
+                    size_t i;
+                    lua_createtable(L, count, 0);
+                    for(i=0; i<count; i++) {
+                        lua_pushinteger(L, client_ids[i]);
+                        lua_rawseti(L, -2, i+1);
+                    }
                     n++;
                     break;
                 }
@@ -136,9 +178,58 @@ _lua_actor_dispatch(uint32_t source, uint32_t self, int type, int session, void*
                     n++;
                     break;
 
+                case SE_CONGESTED:
+                case SE_WRITABLE:
+                    lua_pushinteger(L, sdata->u.size);
+                    n++;
+                    break;
+
+                // push the datagram and the peer address
+                case SE_UDP: {
+                    size_t addr_len = sdata->data[0];
+                    lua_pushlstring(L, (const char*)sdata->data + 1 + addr_len, sdata->u.size - 1 - addr_len);
+                    lua_pushlstring(L, (const char*)sdata->data + 1, addr_len);
+                    n += 2;
+                    break;
+                }
+
+                case SE_RELAY_READY:
+                    break;
+
+                // push bytes sent, bytes received and the error
+                case SE_RELAY_END: {
+                    uint64_t sent, received;
+                    size_t len = sdata->u.size - sizeof(uint64_t)*2;
+                    memcpy(&sent, sdata->data, sizeof(sent));
+                    memcpy(&received, sdata->data + sizeof(sent), sizeof(received));
+                    lua_pushinteger(L, (lua_Integer)sent);
+                    lua_pushinteger(L, (lua_Integer)received);
+                    if(len == 0) {
+                        lua_pushnil(L);
+                    }else {
+                        lua_pushlstring(L, (const char*)sdata->data + sizeof(uint64_t)*2, len);
+                    }
+                    n += 3;
+                    break;
+                }
+
                 default:
                     hive_panic("invalid socket event:%d", se);
             }
+        }else if(type == HIVE_TTIMER) {
+            // push sessions table and counts table
+            const int* pairs = (const int*)data;
+            size_t count = sz / (sizeof(int)*2);
+            size_t i=0;
+            lua_createtable(L, count, 0);
+            lua_createtable(L, count, 0);
+            for(i=0; i<count; i++) {
+                lua_pushinteger(L, pairs[2*i]);
+                lua_rawseti(L, -3, i+1);
+                lua_pushinteger(L, pairs[2*i+1]);
+                lua_rawseti(L, -2, i+1);
+            }
+            n++;
         }else {
             lua_pushlstring(L, (const char*)data, sz);
         }
@@ -181,6 +272,33 @@ _lhive_timer_register(lua_State* L) {
     return 1;
 }
 
+static int
+_lhive_timer_interval(lua_State* L) {
+    lua_Integer interval = luaL_checkinteger(L, 1);
+    struct actor_state* state = _self_state(L);
+    if(interval <= 0) {
+        luaL_error(L, "timer interval:%d invalid.", interval);
+    }
+    int session = hive_timer_interval(interval, state->handle);
+    lua_pushinteger(L, session);
+    return 1;
+}
+
+static int
+_lhive_timer_cancel(lua_State* L) {
+    int session = luaL_checkinteger(L, 1);
+    struct actor_state* state = _self_state(L);
+    bool b = hive_timer_cancel(session, state->handle);
+    lua_pushboolean(L, b);
+    return 1;
+}
+
+static int
+_lhive_timer_tickms(lua_State* L) {
+    lua_pushinteger(L, hive_timer_tickms());
+    return 1;
+}
+
 static int
 _lhive_timer_gettime(lua_State* L) {
     uint64_t t = hive_timer_gettime();
@@ -191,7 +309,8 @@ _lhive_timer_gettime(lua_State* L) {
 
 static uint32_t
 __hive_register(lua_State* L, const char* path, const char* name, void* data, size_t sz) {
-    lua_State* NL = luaL_newstate();
+    lua_State* NL = lua_newstate(_lua_alloc, NULL);
+    lua_atpanic(NL, _lua_panic);
     struct actor_state* state = (struct actor_state*)lua_newuserdata(NL, sizeof(struct actor_state));
     state->L = NL;
     state->handle = 0;
@@ -273,6 +392,24 @@ _lhive_send(lua_State* L) {
 }
 
 
+static int
+_lhive_memstat(lua_State* L) {
+    struct hive_memory_stat stat[HIVE_MEMORY_TYPE_COUNT];
+    hive_memory_stat(stat);
+    lua_createtable(L, 0, HIVE_MEMORY_TYPE_COUNT);
+    int i=0;
+    for(i=0; i<HIVE_MEMORY_TYPE_COUNT; i++) {
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, stat[i].bytes);
+        lua_setfield(L, -2, "bytes");
+        lua_pushinteger(L, stat[i].count);
+        lua_setfield(L, -2, "count");
+        lua_setfield(L, -2, hive_memory_typename(i));
+    }
+    return 1;
+}
+
+
 static void
 _set_const(lua_State* L, const char* fieldname, int v) {
     int table_idx = lua_gettop(L);
@@ -281,13 +418,53 @@ _set_const(lua_State* L, const char* fieldname, int v) {
 }
 
 
+static int
+_opt_field_integer(lua_State* L, int idx, const char* name) {
+    lua_getfield(L, idx, name);
+    lua_Integer v = luaL_optinteger(L, -1, 0);
+    lua_pop(L, 1);
+    if(v < 0 || v > INT_MAX) {
+        luaL_error(L, "invalid socket option %s", name);
+    }
+    return (int)v;
+}
+
+static int
+_opt_field_boolean(lua_State* L, int idx, const char* name) {
+    lua_getfield(L, idx, name);
+    int v = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return v;
+}
+
+// read the optional options table at idx, attach is true to attach accepted sockets to self
+static void
+_opt_socket(lua_State* L, int idx, struct socket_opt* out_opt) {
+    memset(out_opt, 0, sizeof(*out_opt));
+    if(lua_isnoneornil(L, idx)) {
+        return;
+    }
+    luaL_checktype(L, idx, LUA_TTABLE);
+    out_opt->backlog = _opt_field_integer(L, idx, "backlog");
+    out_opt->nodelay = _opt_field_boolean(L, idx, "nodelay");
+    out_opt->keepalive = _opt_field_boolean(L, idx, "keepalive");
+    out_opt->sndbuf = _opt_field_integer(L, idx, "sndbuf");
+    out_opt->rcvbuf = _opt_field_integer(L, idx, "rcvbuf");
+    if(_opt_field_boolean(L, idx, "attach")) {
+        out_opt->attach_handle = _self_state(L)->handle;
+    }
+}
+
+
 static int
 _lhive_socket_connect(lua_State* L) {
     const char* host = luaL_checkstring(L, 1);
     uint16_t port = (uint16_t)luaL_checkinteger(L, 2);
+    struct socket_opt opt;
+    _opt_socket(L, 3, &opt);
     struct actor_state* state = _self_state(L);
     const char* err_str = NULL;
-    int id = hive_socket_connect(host, port, state->handle, &err_str);
+    int id = hive_socket_connect_opt(host, port, state->handle, &opt, &err_str);
     if (id<0) {
         lua_pushboolean(L, false);
         lua_pushstring(L, err_str);
@@ -326,8 +503,10 @@ static int
 _lhive_socket_listen(lua_State* L) {
     const char* host = luaL_checkstring(L, 1);
     uint16_t port = (uint16_t)luaL_checkinteger(L, 2);
+    struct socket_opt opt;
+    _opt_socket(L, 3, &opt);
     struct actor_state* state = _self_state(L);
-    int id = hive_socket_listen(host, port, state->handle);
+    int id = hive_socket_listen_opt(host, port, state->handle, &opt);
     lua_pushinteger(L, id);
     return 1;
 }
@@ -354,6 +533,215 @@ _lhive_socket_send(lua_State* L) {
 }
 
 
+#define MAX_LUA_SENDV 64
+
+static int
+_lhive_socket_sendv(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    int top = lua_gettop(L);
+    int count = top - 1;
+    luaL_argcheck(L, count > 0 && count <= MAX_LUA_SENDV, 2, "invalid fragment count");
+    struct iovec iov[MAX_LUA_SENDV];
+    int i;
+    for(i=0; i<count; i++) {
+        size_t size;
+        const char* s = luaL_checklstring(L, i+2, &size);
+        iov[i].iov_base = (void*)s;
+        iov[i].iov_len = size;
+    }
+    int ret = hive_socket_sendv(id, iov, count);
+    lua_pushinteger(L, ret);
+    return 1;
+}
+
+
+static int
+_lhive_socket_connect_unix(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    struct socket_opt opt;
+    _opt_socket(L, 2, &opt);
+    struct actor_state* state = _self_state(L);
+    const char* err_str = NULL;
+    int id = hive_socket_connect_unix(path, state->handle, &opt, &err_str);
+    if (id<0) {
+        lua_pushboolean(L, false);
+        lua_pushstring(L, err_str);
+        return 2;
+    }else {
+        lua_pushinteger(L, id);
+        return 1;
+    }
+}
+
+
+static int
+_lhive_socket_listen_unix(lua_State* L) {
+    const char* path = luaL_checkstring(L, 1);
+    struct socket_opt opt;
+    _opt_socket(L, 2, &opt);
+    struct actor_state* state = _self_state(L);
+    int id = hive_socket_listen_unix(path, state->handle, &opt);
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+
+static int
+_lhive_socket_udp(lua_State* L) {
+    const char* host = luaL_optstring(L, 1, NULL);
+    uint16_t port = (uint16_t)luaL_optinteger(L, 2, 0);
+    struct socket_opt opt;
+    _opt_socket(L, 3, &opt);
+    struct actor_state* state = _self_state(L);
+    const char* err_str = NULL;
+    int id = hive_socket_udp(host, port, state->handle, &opt, &err_str);
+    if(id < 0) {
+        lua_pushboolean(L, false);
+        lua_pushstring(L, err_str);
+        return 2;
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+
+static int
+_lhive_socket_sendto(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    size_t addr_len;
+    const char* addr = luaL_checklstring(L, 2, &addr_len);
+    int top = lua_gettop(L);
+    int count = top - 2;
+    luaL_argcheck(L, count > 0 && count <= MAX_LUA_SENDV, 3, "invalid datagram count");
+    struct iovec iov[MAX_LUA_SENDV];
+    int i;
+    for(i=0; i<count; i++) {
+        size_t size;
+        const char* s = luaL_checklstring(L, i+3, &size);
+        iov[i].iov_base = (void*)s;
+        iov[i].iov_len = size;
+    }
+    lua_pushinteger(L, hive_socket_sendto(id, addr, addr_len, iov, count));
+    return 1;
+}
+
+
+// the address of SE_UDP to ip and port
+static int
+_lhive_socket_udp_address(lua_State* L) {
+    size_t addr_len;
+    const char* addr = luaL_checklstring(L, 1, &addr_len);
+    luaL_argcheck(L, addr_len >= sizeof(sa_family_t) && addr_len <= sizeof(struct sockaddr_storage), 1, "invalid address");
+    struct sockaddr_storage ss;
+    memcpy(&ss, addr, addr_len);
+    char ip[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    int err = getnameinfo((struct sockaddr*)&ss, addr_len, ip, sizeof(ip), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+    if(err != 0) {
+        lua_pushboolean(L, false);
+        lua_pushstring(L, gai_strerror(err));
+        return 2;
+    }
+    lua_pushstring(L, ip);
+    lua_pushinteger(L, atoi(port));
+    return 2;
+}
+
+
+// numeric ip and port to the address of sendto
+static int
+_lhive_socket_udp_peer(lua_State* L) {
+    const char* ip = luaL_checkstring(L, 1);
+    uint16_t port = (uint16_t)luaL_checkinteger(L, 2);
+    struct sockaddr_in in4;
+    struct sockaddr_in6 in6;
+    memset(&in4, 0, sizeof(in4));
+    memset(&in6, 0, sizeof(in6));
+    if(inet_pton(AF_INET, ip, &in4.sin_addr) == 1) {
+        in4.sin_family = AF_INET;
+        in4.sin_port = htons(port);
+        lua_pushlstring(L, (const char*)&in4, sizeof(in4));
+    }else if(inet_pton(AF_INET6, ip, &in6.sin6_addr) == 1) {
+        in6.sin6_family = AF_INET6;
+        in6.sin6_port = htons(port);
+        lua_pushlstring(L, (const char*)&in6, sizeof(in6));
+    }else {
+        lua_pushboolean(L, false);
+        lua_pushfstring(L, "invalid ip: %s", ip);
+        return 2;
+    }
+    return 1;
+}
+
+
+static int
+_lhive_socket_watermark(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_Integer high = luaL_checkinteger(L, 2);
+    lua_Integer low = luaL_optinteger(L, 3, high/2);
+    luaL_argcheck(L, high >= 0, 2, "invalid high watermark");
+    luaL_argcheck(L, low >= 0 && low <= high, 3, "invalid low watermark");
+    int ret = hive_socket_watermark(id, (size_t)high, (size_t)low);
+    lua_pushinteger(L, ret);
+    return 1;
+}
+
+
+static int
+_lhive_socket_relay(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    int peer_id = luaL_checkinteger(L, 2);
+    lua_pushinteger(L, hive_socket_relay(id, peer_id));
+    return 1;
+}
+
+
+static int
+_lhive_socket_relay_start(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, hive_socket_relay_start(id));
+    return 1;
+}
+
+
+static int
+_lhive_socket_queued(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, hive_socket_queued(id));
+    return 1;
+}
+
+
+static int
+_lhive_socket_timeout(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_Integer connect_ms = luaL_optinteger(L, 2, 0);
+    lua_Integer read_ms = luaL_optinteger(L, 3, 0);
+    lua_Integer write_ms = luaL_optinteger(L, 4, 0);
+    luaL_argcheck(L, connect_ms >= 0 && connect_ms <= INT_MAX, 2, "invalid connect timeout");
+    luaL_argcheck(L, read_ms >= 0 && read_ms <= INT_MAX, 3, "invalid read timeout");
+    luaL_argcheck(L, write_ms >= 0 && write_ms <= INT_MAX, 4, "invalid write timeout");
+    lua_pushinteger(L, hive_socket_timeout(id, (int)connect_ms, (int)read_ms, (int)write_ms));
+    return 1;
+}
+
+
+static int
+_lhive_socket_pause(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, hive_socket_pause(id));
+    return 1;
+}
+
+
+static int
+_lhive_socket_resume(lua_State* L) {
+    int id = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, hive_socket_resume(id));
+    return 1;
+}
+
+
 static int
 _lhive_socket_close(lua_State* L) {
     int id = luaL_checkinteger(L, 1);
@@ -383,10 +771,14 @@ hive_lib(lua_State* L) {
         {"hive_send", _lhive_send},
         {"hive_log", _lhive_log},
         {"hive_name", _lhive_name},
+        {"hive_memstat", _lhive_memstat},
 
         // timer api
         {"hive_timer_register", _lhive_timer_register},
+        {"hive_timer_interval", _lhive_timer_interval},
+        {"hive_timer_cancel", _lhive_timer_cancel},
         {"hive_timer_gettime", _lhive_timer_gettime},
+        {"hive_timer_tickms", _lhive_timer_tickms},
 
         //  socket lua api
         {"hive_socket_connect", _lhive_socket_connect},
@@ -394,6 +786,20 @@ hive_lib(lua_State* L) {
         {"hive_socket_addrinfo", _lhive_socket_addrinfo},
         {"hive_socket_attach", _lhive_socket_attach},
         {"hive_socket_send", _lhive_socket_send},
+        {"hive_socket_sendv", _lhive_socket_sendv},
+        {"hive_socket_connect_unix", _lhive_socket_connect_unix},
+        {"hive_socket_listen_unix", _lhive_socket_listen_unix},
+        {"hive_socket_udp", _lhive_socket_udp},
+        {"hive_socket_sendto", _lhive_socket_sendto},
+        {"hive_socket_udp_address", _lhive_socket_udp_address},
+        {"hive_socket_udp_peer", _lhive_socket_udp_peer},
+        {"hive_socket_watermark", _lhive_socket_watermark},
+        {"hive_socket_queued", _lhive_socket_queued},
+        {"hive_socket_timeout", _lhive_socket_timeout},
+        {"hive_socket_relay", _lhive_socket_relay},
+        {"hive_socket_relay_start", _lhive_socket_relay_start},
+        {"hive_socket_pause", _lhive_socket_pause},
+        {"hive_socket_resume", _lhive_socket_resume},
         {"hive_socket_close", _lhive_socket_close},
         {NULL, NULL},
     };
@@ -409,6 +815,11 @@ hive_lib(lua_State* L) {
     _set_const(L, "SE_ACCEPT", SE_ACCEPT);
     _set_const(L, "SE_RECIVE", SE_RECIVE);
     _set_const(L, "SE_ERROR", SE_ERROR);
+    _set_const(L, "SE_CONGESTED", SE_CONGESTED);
+    _set_const(L, "SE_WRITABLE", SE_WRITABLE);
+    _set_const(L, "SE_UDP", SE_UDP);
+    _set_const(L, "SE_RELAY_READY", SE_RELAY_READY);
+    _set_const(L, "SE_RELAY_END", SE_RELAY_END);
     _set_const(L, "HIVE_LOG_DBG", HIVE_LOG_DBG);
     _set_const(L, "HIVE_LOG_INF", HIVE_LOG_INF);
     _set_const(L, "HIVE_LOG_ERR", HIVE_LOG_ERR);
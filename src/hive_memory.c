@@ -1,11 +1,88 @@
-#ifdef DEBUG_MEMORY
-
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 
 #include "spinlock.h"
+#include "hive_memory.h"
+
+
+// per thread counters, only the owner thread write it and other threads read it by sum.
+// they are loaded and stored by relaxed atomics, so the sum never see a torn value.
+// the record is keep until process exit, so the sum is correct after thread exit.
+struct memory_thread_stat {
+    struct hive_memory_stat stat[HIVE_MEMORY_TYPE_COUNT];
+    struct memory_thread_stat* next;
+};
+
+static struct {
+    struct spinlock lock;
+    struct memory_thread_stat* list;
+} STAT_CONTEXT;  // lock will be init
+
+static __thread struct memory_thread_stat* THREAD_STAT = NULL;
+
+static const char* memory_typename[] = {
+    [HIVE_MEMORY_OTHER] = "other",
+    [HIVE_MEMORY_MAILBOX] = "mailbox",
+    [HIVE_MEMORY_SOCKET] = "socket",
+    [HIVE_MEMORY_TIMER] = "timer",
+    [HIVE_MEMORY_LUA] = "lua",
+    [HIVE_MEMORY_GATE] = "gate",
+};
+
+
+static inline struct memory_thread_stat*
+_thread_stat() {
+    struct memory_thread_stat* ts = THREAD_STAT;
+    if(ts == NULL) {
+        ts = (struct memory_thread_stat*)calloc(1, sizeof(*ts));
+        spinlock_lock(&STAT_CONTEXT.lock);
+        ts->next = STAT_CONTEXT.list;
+        STAT_CONTEXT.list = ts;
+        spinlock_unlock(&STAT_CONTEXT.lock);
+        THREAD_STAT = ts;
+    }
+    return ts;
+}
+
+
+void
+hive_memory_account(int type, int64_t bytes, int64_t count) {
+    assert(type >= 0 && type < HIVE_MEMORY_TYPE_COUNT);
+    struct hive_memory_stat* stat = &(_thread_stat()->stat[type]);
+    __atomic_store_n(&stat->bytes, __atomic_load_n(&stat->bytes, __ATOMIC_RELAXED) + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&stat->count, __atomic_load_n(&stat->count, __ATOMIC_RELAXED) + count, __ATOMIC_RELAXED);
+}
+
+
+void
+hive_memory_stat(struct hive_memory_stat* out_stat) {
+    int i=0;
+    memset(out_stat, 0, sizeof(struct hive_memory_stat)*HIVE_MEMORY_TYPE_COUNT);
+    spinlock_lock(&STAT_CONTEXT.lock);
+    struct memory_thread_stat* ts = STAT_CONTEXT.list;
+    while(ts) {
+        for(i=0; i<HIVE_MEMORY_TYPE_COUNT; i++) {
+            out_stat[i].bytes += __atomic_load_n(&ts->stat[i].bytes, __ATOMIC_RELAXED);
+            out_stat[i].count += __atomic_load_n(&ts->stat[i].count, __ATOMIC_RELAXED);
+        }
+        ts = ts->next;
+    }
+    spinlock_unlock(&STAT_CONTEXT.lock);
+}
+
+
+const char*
+hive_memory_typename(int type) {
+    if(type < 0 || type >= HIVE_MEMORY_TYPE_COUNT) {
+        return NULL;
+    }
+    return memory_typename[type];
+}
+
+
+#ifdef DEBUG_MEMORY
 
 #define HEAD_SIZE  sizeof(int)
 #define MAX_MEMORY_SLOT_COUNT 0xffff
@@ -17,6 +94,7 @@
 struct memory_slot {
     const char* file;
     int line;
+    int type;
     void* p;
     size_t size;
 };
@@ -52,7 +130,7 @@ _get_idx() {
 
 
 void*
-hive_memory_malloc(size_t size, const char* file, int line) {
+hive_memory_malloc(size_t size, int type, const char* file, int line) {
     int* ret = malloc(size + HEAD_SIZE);
     
     context_lock();
@@ -66,14 +144,16 @@ hive_memory_malloc(size_t size, const char* file, int line) {
     slot_p->file = file;
     slot_p->p = (void*)(ret+1);
     slot_p->line = line;
+    slot_p->type = type;
+    hive_memory_account(type, (int64_t)size, 1);
     return slot_p->p;
 }
 
 
 void*
-hive_memory_calloc(size_t count, size_t size, const char* file, int line) {
+hive_memory_calloc(size_t count, size_t size, int type, const char* file, int line) {
     size_t c_size = count*size;
-    void* ret = hive_memory_malloc(c_size, file, line);
+    void* ret = hive_memory_malloc(c_size, type, file, line);
     memset(ret, 0, c_size);
     return ret;
 }
@@ -90,6 +170,7 @@ hive_memory_free(void* p) {
     free(_point(p));
 
     struct memory_slot* slot_p = &(MEMORY_CONTEXT.buffer[idx]);
+    hive_memory_account(slot_p->type, -(int64_t)slot_p->size, -1);
     context_lock();
     slot_p->p = NULL;
     slot_p->size = 0;
@@ -107,6 +188,7 @@ hive_memory_realloc(void* p, size_t size, const char* file, int line) {
     *ret = idx;
 
     struct memory_slot* slot_p = &(MEMORY_CONTEXT.buffer[idx]);
+    hive_memory_account(slot_p->type, (int64_t)size - (int64_t)slot_p->size, 0);
     slot_p->size = size;
     slot_p->line = line;
     slot_p->file = file;
@@ -134,5 +216,71 @@ hive_memroy_dump() {
     }
 }
 
+#else
+
+// release allocator keep size and type in a cookie before the user memory
+struct memory_cookie {
+    size_t size;
+    int type;
+};
+
+#define COOKIE_SIZE 16
+#define _cookie(p) ((struct memory_cookie*)(((char*)(p)) - COOKIE_SIZE))
+#define _user_point(c) ((void*)(((char*)(c)) + COOKIE_SIZE))
+
+
+static inline void*
+_cookie_init(struct memory_cookie* cookie, size_t size, int type) {
+    if(cookie == NULL) {
+        return NULL;
+    }
+    cookie->size = size;
+    cookie->type = type;
+    hive_memory_account(type, (int64_t)size, 1);
+    return _user_point(cookie);
+}
+
+
+void*
+hive_memory_malloc(size_t size, int type) {
+    assert(sizeof(struct memory_cookie) <= COOKIE_SIZE);
+    struct memory_cookie* cookie = (struct memory_cookie*)malloc(size + COOKIE_SIZE);
+    return _cookie_init(cookie, size, type);
+}
+
+
+void*
+hive_memory_calloc(size_t count, size_t size, int type) {
+    size_t c_size = count*size;
+    struct memory_cookie* cookie = (struct memory_cookie*)calloc(1, c_size + COOKIE_SIZE);
+    return _cookie_init(cookie, c_size, type);
+}
+
+
+void*
+hive_memory_realloc(void* p, size_t size) {
+    assert(p);
+    struct memory_cookie* cookie = _cookie(p);
+    size_t old_size = cookie->size;
+    cookie = (struct memory_cookie*)realloc(cookie, size + COOKIE_SIZE);
+    if(cookie == NULL) {
+        return NULL;
+    }
+    cookie->size = size;
+    hive_memory_account(cookie->type, (int64_t)size - (int64_t)old_size, 0);
+    return _user_point(cookie);
+}
+
+
+void
+hive_memory_free(void* p) {
+    if(p == NULL) {
+        return;
+    }
+    struct memory_cookie* cookie = _cookie(p);
+    hive_memory_account(cookie->type, -(int64_t)cookie->size, -1);
+    free(cookie);
+}
+
 #endif
 
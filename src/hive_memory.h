@@ -1,29 +1,61 @@
 #ifndef _HIVE_MEMORY_H_
 #define _HIVE_MEMORY_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+enum hive_memory_type {
+    HIVE_MEMORY_OTHER,
+    HIVE_MEMORY_MAILBOX,
+    HIVE_MEMORY_SOCKET,
+    HIVE_MEMORY_TIMER,
+    HIVE_MEMORY_LUA,
+    HIVE_MEMORY_GATE,
+
+    HIVE_MEMORY_TYPE_COUNT,
+};
+
+struct hive_memory_stat {
+    int64_t bytes;
+    int64_t count;
+};
+
+// define HIVE_MEMORY_TYPE before include this file to tag the allocation of a subsystem
+#ifndef HIVE_MEMORY_TYPE
+    #define HIVE_MEMORY_TYPE HIVE_MEMORY_OTHER
+#endif
+
+// out_stat must have HIVE_MEMORY_TYPE_COUNT elements
+void hive_memory_stat(struct hive_memory_stat* out_stat);
+const char* hive_memory_typename(int type);
+void hive_memory_account(int type, int64_t bytes, int64_t count);
+
 
 #ifdef DEBUG_MEMORY
-    #include <stddef.h>
-    void*   hive_memory_malloc(size_t size, const char* file, int line);
-    void*   hive_memory_calloc(size_t count, size_t size, const char* file, int line);
+    void*   hive_memory_malloc(size_t size, int type, const char* file, int line);
+    void*   hive_memory_calloc(size_t count, size_t size, int type, const char* file, int line);
     void*   hive_memory_realloc(void* p, size_t size, const char* file, int line);
     void    hive_memory_free(void* p);
     void    hive_memroy_dump();
 
-    #define hive_malloc(size)   hive_memory_malloc(size, __FILE__, __LINE__)
-    #define hive_calloc(count, size)    hive_memory_calloc(count, size, __FILE__, __LINE__)
+    #define hive_malloc(size)   hive_memory_malloc(size, HIVE_MEMORY_TYPE, __FILE__, __LINE__)
+    #define hive_calloc(count, size)    hive_memory_calloc(count, size, HIVE_MEMORY_TYPE, __FILE__, __LINE__)
     #define hive_realloc(p, size)   hive_memory_realloc(p, size, __FILE__, __LINE__)
     #define hive_free(p)    hive_memory_free(p)
     #define hive_memdump()  hive_memroy_dump()
 
 #else
-    #include <stdlib.h>
-    #define hive_malloc   malloc
-    #define hive_calloc   calloc
-    #define hive_realloc  realloc
-    #define hive_free     free
+    void*   hive_memory_malloc(size_t size, int type);
+    void*   hive_memory_calloc(size_t count, size_t size, int type);
+    void*   hive_memory_realloc(void* p, size_t size);
+    void    hive_memory_free(void* p);
+
+    #define hive_malloc(size)   hive_memory_malloc(size, HIVE_MEMORY_TYPE)
+    #define hive_calloc(count, size)    hive_memory_calloc(count, size, HIVE_MEMORY_TYPE)
+    #define hive_realloc(p, size)   hive_memory_realloc(p, size)
+    #define hive_free(p)    hive_memory_free(p)
     #define hive_memdump()
 #endif
 
 
-#endif
\ No newline at end of file
+#endif
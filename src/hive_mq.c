@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <assert.h>
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_MAILBOX
 #include "hive_memory.h"
 #include "spinlock.h"
 #include "hive_mq.h"
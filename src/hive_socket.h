@@ -4,13 +4,19 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <netdb.h>
+#include <sys/uio.h>
 
 enum socket_event {
     SE_CONNECTED,
     SE_BREAK,
-    SE_ACCEPT,
+    SE_ACCEPT,      // u.size is count of accepted ids, data is the int array of them
     SE_RECIVE,
     SE_ERROR,
+    SE_CONGESTED,   // queued send bytes reach the high watermark, u.size is queued bytes
+    SE_WRITABLE,    // queued send bytes of a congested socket drop to the low watermark
+    SE_UDP,         // data is uint8 address length, the peer sockaddr and the datagram. u.size is size of data
+    SE_RELAY_READY, // the relay is linked and hold, the data received before it is delivered already
+    SE_RELAY_END,   // both relay sockets are closed, data is uint64 bytes sent, uint64 bytes received and the error
 };
 
 
@@ -28,9 +34,48 @@ struct socket_addrinfo {
     int port;
 };
 
+// zero is the default of every field.
+// the accepted sockets inherit the options of listener.
+struct socket_opt {
+    int backlog;    // listen backlog, default is 128
+    int nodelay;    // TCP_NODELAY
+    int keepalive;  // SO_KEEPALIVE
+    int sndbuf;     // SO_SNDBUF bytes
+    int rcvbuf;     // SO_RCVBUF bytes
+    uint32_t attach_handle; // listen only, the accepted sockets are attached to it when SE_ACCEPT is received
+};
+
 int hive_socket_connect(const char* host, uint16_t port, uint32_t actor_handle, char const** out_error);
+int hive_socket_connect_opt(const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt, char const** out_error);
 int hive_socket_listen(const char* host, uint16_t port, uint32_t actor_handle);
+int hive_socket_listen_opt(const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt);
+// stream socket of a local path, a path start with '@' is the abstract name on linux.
+// the addrinfo of it is the path and port 0
+int hive_socket_connect_unix(const char* path, uint32_t actor_handle, const struct socket_opt* opt, char const** out_error);
+int hive_socket_listen_unix(const char* path, uint32_t actor_handle, const struct socket_opt* opt);
 int hive_socket_send(int id, const void* data, size_t size);
+// send count fragments atomically as one write
+int hive_socket_sendv(int id, const struct iovec* iov, int count);
+// bind a udp socket, host NULL is any address. the datagrams are received by SE_UDP
+int hive_socket_udp(const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt, char const** out_error);
+// send every iov as a datagram to the sockaddr, at most 64 datagrams
+int hive_socket_sendto(int id, const void* addr, size_t addr_len, const struct iovec* iov, int count);
+// high 0 disable the watermark notify, it is disabled by default
+int hive_socket_watermark(int id, size_t high, size_t low);
+// bytes are queued but not written to kernel yet, -1 is invalid id
+int64_t hive_socket_queued(int id);
+// ms of connect, read idle and write stall timeout, 0 is disable. the expired socket is closed
+// with SE_CONNECTED "connect timeout", SE_ERROR "read timeout" or SE_ERROR "write timeout"
+int hive_socket_timeout(int id, int connect_ms, int read_ms, int write_ms);
+// relay the data between two attached sockets in socket thread, splice is used on linux.
+// SE_RELAY_READY is sent to actor of id, then relay_start begin it after the received data is sent.
+// send to the relayed sockets is refused with -2 after relay_start.
+// SE_RELAY_END is sent when both sides are eof or at any error, the sockets are closed by it.
+int hive_socket_relay(int id, int peer_id);
+int hive_socket_relay_start(int id);
+// stop and restart reading, the unread data stay in kernel and the tcp window push back to peer
+int hive_socket_pause(int id);
+int hive_socket_resume(int id);
 int hive_socket_addrinfo(int id, struct socket_addrinfo* out_addrinfo, const char** out_error);
 int hive_socket_attach(int id, uint32_t actor_handle);
 int hive_socket_close(int id);
@@ -3,12 +3,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
-#include <sys/time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "spinlock.h"
+#include "atomic.h"
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_TIMER
 #include "hive_memory.h"
 #include "hive.h"
-#include "actor_log.h"
+#include "hive_timer.h"
 
 
 struct user_data {
@@ -16,10 +20,16 @@ struct user_data {
     uint32_t handle;
 };
 
+struct timer_list;
+
 struct timer_node {
     uint32_t expire;
+    uint32_t interval;  // 0 is one shot timer
     struct user_data data;
     struct timer_node* next;
+    struct timer_node* prev;
+    struct timer_list* list;
+    struct timer_node* hash_next;  // session index chain
 };
 
 struct timer_list {
@@ -27,6 +37,13 @@ struct timer_list {
     struct timer_node* tail;
 };
 
+struct timer_expire {
+    struct user_data data;
+    uint32_t expire;
+    uint32_t count;
+    size_t seq;
+};
+
 #define NEAR_SHIFT 8
 #define NEAR       (1<<NEAR_SHIFT)
 #define NEAR_MASK  (NEAR-1)
@@ -36,80 +53,238 @@ struct timer_list {
 #define LEVEL_MASK  (LEVEL-1)
 
 
-struct timer_state {
+#define DEFAULT_INDEX_SIZE 64
+#define DEFAULT_EXPIRE_SIZE 64
+#define NODE_CHUNK_SIZE 256
+
+#define MIN_RESOLUTION 1
+#define MAX_RESOLUTION 1000
+#define MAX_SHARD 64
+
+#define time_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+// nodes are allocated by chunk and never return to hive_free until the timer is destroyed
+struct timer_chunk {
+    struct timer_chunk* next;
+    struct timer_node nodes[NODE_CHUNK_SIZE];
+};
+
+// sleep word of timer thread: state in high 32 bits, wakeup tick in low 32 bits
+#define SLEEP_NONE    0
+#define SLEEP_UNTIL   1
+#define SLEEP_FOREVER 2
+#define sleep_word(st, time) (((uint64_t)(st) << 32) | (uint32_t)(time))
+
+
+// every shard is a full wheel with its own lock. a thread insert into its own shard,
+// the session carry the shard index in low bits so cancel lock only that shard.
+struct timer_shard {
     struct spinlock lock;
     struct timer_list near_wheel[NEAR];
     struct timer_list level_wheel[4][LEVEL];
     uint32_t cur_time;
-    uint64_t last_real_time;
-    int session;
+    uint32_t seq;
+    int count;
+
+    // free nodes linked by next
+    struct timer_node* free_list;
+    struct timer_chunk* chunks;
+
+    // session to node index
+    struct {
+        struct timer_node** slots;
+        uint32_t size;
+    } index;
 };
 
+struct timer_state {
+    struct timer_shard* shards;
+    uint32_t shard_bits;
+    int shard_next;             // round robin shard of new thread
+    uint64_t start_tick;        // tick of create time, tick 0 of wheel
+    uint64_t last_real_time;    // only used by timer thread
+    uint32_t real_tick;
+    uint32_t resolution;    // ms per tick
+    clockid_t clock_id;
+
+    // expired timers of one update, only used by timer thread
+    struct {
+        struct timer_expire* slots;
+        int* sessions;
+        size_t size;
+        size_t count;
+    } expired;
+
+    // tickless sleep of timer thread
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint64_t sleep;
+    bool wakeup;
+};
+
+static __thread int THREAD_SHARD = -1;
 
+
+static inline uint64_t
+_clock_ms(clockid_t clock_id) {
+    struct timespec ts;
+    clock_gettime(clock_id, &ts);
+    uint64_t t_ms = (uint64_t)ts.tv_sec * 1000;
+    t_ms += ts.tv_nsec / 1000000;
+    return t_ms;
+}
+
+// monotonic ms, don't jump with wall clock
 uint64_t
 hive_timer_gettime() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    uint64_t t_ms = (uint64_t)(tv.tv_sec * 1000);
-    t_ms += tv.tv_usec / 1000;
-    return t_ms;
+    return _clock_ms(CLOCK_MONOTONIC);
+}
+
+// use the cheap coarse clock when it is precise enough for resolution
+static clockid_t
+_timer_clock(uint32_t resolution) {
+#ifdef CLOCK_MONOTONIC_COARSE
+    struct timespec ts;
+    if(clock_getres(CLOCK_MONOTONIC_COARSE, &ts) == 0 &&
+       ts.tv_sec == 0 && ts.tv_nsec <= (long)resolution * 1000000 / 2) {
+        return CLOCK_MONOTONIC_COARSE;
+    }
+#endif
+    return CLOCK_MONOTONIC;
 }
 
 
 struct timer_state *
-hive_timer_create() {
+hive_timer_create(uint32_t resolution, int shard_count) {
+    if(resolution < MIN_RESOLUTION) {
+        resolution = MIN_RESOLUTION;
+    }else if(resolution > MAX_RESOLUTION) {
+        resolution = MAX_RESOLUTION;
+    }
+
+    uint32_t shard_bits = 0;
+    while((1<<shard_bits) < shard_count && (1<<shard_bits) < MAX_SHARD) {
+        shard_bits++;
+    }
+    uint32_t shard_size = 1<<shard_bits;
+
     struct timer_state* ret = (struct timer_state*)hive_malloc(sizeof(*ret));
     memset(ret, 0, sizeof(*ret));
-    ret->cur_time = 0;
-    ret->session = 0;
-    ret->last_real_time = hive_timer_gettime();
-    spinlock_init(&ret->lock);
+    ret->shard_bits = shard_bits;
+    ret->shards = (struct timer_shard*)hive_calloc(shard_size, sizeof(struct timer_shard));
+    uint32_t i=0;
+    for(i=0; i<shard_size; i++) {
+        struct timer_shard* shard = &ret->shards[i];
+        spinlock_init(&shard->lock);
+        shard->index.size = DEFAULT_INDEX_SIZE;
+        shard->index.slots = (struct timer_node**)hive_calloc(DEFAULT_INDEX_SIZE, sizeof(struct timer_node*));
+    }
+    ret->shard_next = 0;
+    ret->real_tick = 0;
+    ret->resolution = resolution;
+    ret->clock_id = _timer_clock(resolution);
+    ret->last_real_time = _clock_ms(ret->clock_id);
+    ret->start_tick = ret->last_real_time / resolution;
+    ret->expired.size = DEFAULT_EXPIRE_SIZE;
+    ret->expired.count = 0;
+    ret->expired.slots = (struct timer_expire*)hive_malloc(sizeof(struct timer_expire)*DEFAULT_EXPIRE_SIZE);
+    ret->expired.sessions = (int*)hive_malloc(sizeof(int)*2*DEFAULT_EXPIRE_SIZE);
+    ret->sleep = sleep_word(SLEEP_NONE, 0);
+    pthread_mutex_init(&ret->mutex, NULL);
+#ifdef __APPLE__
+    pthread_cond_init(&ret->cond, NULL);
+#else
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ret->cond, &attr);
+    pthread_condattr_destroy(&attr);
+#endif
     return ret;
 }
 
-static void
-_clear_list(struct timer_list* list) {
-    struct timer_node* p = list->head;
-    while(p) {
-        struct timer_node* next = p->next;
-        hive_free(p);
-        p = next;
-    }
+
+uint32_t
+hive_timer_resolution(struct timer_state* state) {
+    return state->resolution;
 }
 
 void
 hive_timer_free(struct timer_state* state) {
-    int i=0;
-    for(i=0; i<NEAR; i++) {
-        _clear_list(&state->near_wheel[i]);
-    }
-    int j=0;
-    for(i=0; i<4; i++) {
-        for(j=0; j<LEVEL; j++) {
-            _clear_list(&state->level_wheel[i][j]);
+    uint32_t shard_size = 1<<state->shard_bits;
+    uint32_t s=0;
+    for(s=0; s<shard_size; s++) {
+        struct timer_shard* shard = &state->shards[s];
+        struct timer_chunk* chunk = shard->chunks;
+        while(chunk) {
+            struct timer_chunk* next = chunk->next;
+            hive_free(chunk);
+            chunk = next;
         }
+        hive_free(shard->index.slots);
     }
 
+    pthread_mutex_destroy(&state->mutex);
+    pthread_cond_destroy(&state->cond);
+    hive_free(state->shards);
+    hive_free(state->expired.slots);
+    hive_free(state->expired.sessions);
     hive_free(state);
 }
 
+// tick 0 is the create time, so every thread get the current tick from clock only,
+// the wheel may lag behind it when timer thread is sleeping or catching up.
+static inline uint32_t
+_timer_curtick(struct timer_state* state) {
+    uint64_t now = _clock_ms(state->clock_id);
+    return (uint32_t)(now/state->resolution - state->start_tick);
+}
+
+static void
+_node_grow(struct timer_shard* shard) {
+    struct timer_chunk* chunk = (struct timer_chunk*)hive_malloc(sizeof(*chunk));
+    chunk->next = shard->chunks;
+    shard->chunks = chunk;
+
+    int i=0;
+    for(i=NODE_CHUNK_SIZE-1; i>=0; i--) {
+        struct timer_node* node = &chunk->nodes[i];
+        node->next = shard->free_list;
+        shard->free_list = node;
+    }
+}
+
+// must hold the shard lock
 static struct timer_node *
-_node_new(struct timer_state* state, uint32_t offset, int session, uint32_t handle) {
-    struct timer_node* node = (struct timer_node*)hive_malloc(sizeof(*node));
+_node_new(struct timer_shard* shard, uint32_t expire, uint32_t interval, int session, uint32_t handle) {
+    if(shard->free_list == NULL) {
+        _node_grow(shard);
+    }
+    struct timer_node* node = shard->free_list;
+    shard->free_list = node->next;
     node->next = NULL;
-    node->expire = state->cur_time + offset;
+    node->prev = NULL;
+    node->list = NULL;
+    node->hash_next = NULL;
+    node->expire = expire;
+    node->interval = interval;
     node->data.session = session;
     node->data.handle = handle;
     return node;
 }
 
-static void
-_node_free(struct timer_node* node) {
-    hive_free(node);
+static inline void
+_node_free(struct timer_shard* shard, struct timer_node* node) {
+    node->list = NULL;
+    node->next = shard->free_list;
+    shard->free_list = node;
 }
 
 static void
 _list_append(struct timer_list* list, struct timer_node* node) {
+    node->next = NULL;
+    node->prev = list->tail;
+    node->list = list;
     if(list->tail == NULL) {
         list->head = node;
         list->tail = node;
@@ -119,15 +294,99 @@ _list_append(struct timer_list* list, struct timer_node* node) {
     }
 }
 
+static void
+_list_remove(struct timer_list* list, struct timer_node* node) {
+    if(node->prev) {
+        node->prev->next = node->next;
+    }else {
+        list->head = node->next;
+    }
+
+    if(node->next) {
+        node->next->prev = node->prev;
+    }else {
+        list->tail = node->prev;
+    }
+    node->next = NULL;
+    node->prev = NULL;
+    node->list = NULL;
+}
+
+
+#define shard_mask(state) ((1u<<(state)->shard_bits) - 1)
+// low bits of session is the shard index, hash by the rest
+#define index_hash(state, shard, session) \
+    ((((uint32_t)(session)) >> (state)->shard_bits) & ((shard)->index.size - 1))
 
 static void
-_hive_timer_add(struct timer_state* state, struct timer_node* node) {
+_index_expand(struct timer_state* state, struct timer_shard* shard) {
+    uint32_t old_size = shard->index.size;
+    struct timer_node** old_slots = shard->index.slots;
+    uint32_t size = old_size*2;
+    struct timer_node** slots = (struct timer_node**)hive_calloc(size, sizeof(struct timer_node*));
+    shard->index.size = size;
+    shard->index.slots = slots;
+
+    uint32_t i=0;
+    for(i=0; i<old_size; i++) {
+        struct timer_node* node = old_slots[i];
+        while(node) {
+            struct timer_node* next = node->hash_next;
+            uint32_t hash = index_hash(state, shard, node->data.session);
+            node->hash_next = slots[hash];
+            slots[hash] = node;
+            node = next;
+        }
+    }
+    hive_free(old_slots);
+}
+
+static void
+_index_insert(struct timer_state* state, struct timer_shard* shard, struct timer_node* node) {
+    if((uint32_t)shard->count >= shard->index.size) {
+        _index_expand(state, shard);
+    }
+    uint32_t hash = index_hash(state, shard, node->data.session);
+    node->hash_next = shard->index.slots[hash];
+    shard->index.slots[hash] = node;
+}
+
+static struct timer_node*
+_index_remove(struct timer_state* state, struct timer_shard* shard, int session) {
+    struct timer_node** pp = &(shard->index.slots[index_hash(state, shard, session)]);
+    while(*pp) {
+        struct timer_node* node = *pp;
+        if(node->data.session == session) {
+            *pp = node->hash_next;
+            node->hash_next = NULL;
+            return node;
+        }
+        pp = &(node->hash_next);
+    }
+    return NULL;
+}
+
+static struct timer_node*
+_index_query(struct timer_state* state, struct timer_shard* shard, int session) {
+    struct timer_node* node = shard->index.slots[index_hash(state, shard, session)];
+    while(node) {
+        if(node->data.session == session) {
+            return node;
+        }
+        node = node->hash_next;
+    }
+    return NULL;
+}
+
+
+static void
+_hive_timer_add(struct timer_shard* shard, struct timer_node* node) {
     uint32_t expire = node->expire;
-    uint32_t cur_time = state->cur_time;
+    uint32_t cur_time = shard->cur_time;
 
     if((expire | NEAR_MASK) == (cur_time | NEAR_MASK)) {
         uint32_t idx = expire & NEAR_MASK;
-        _list_append(&state->near_wheel[idx], node);
+        _list_append(&shard->near_wheel[idx], node);
     } else {
         uint32_t value = expire >> NEAR_SHIFT;
         uint32_t time = cur_time >> NEAR_SHIFT;
@@ -140,71 +399,133 @@ _hive_timer_add(struct timer_state* state, struct timer_node* node) {
             time = time >> LEVEL_SHITF;
         }
         uint32_t level = value & LEVEL_MASK;
-        _list_append(&state->level_wheel[i][level], node);
+        _list_append(&shard->level_wheel[i][level], node);
+    }
+}
+
+static int
+_expire_cmp(const void* a, const void* b) {
+    const struct timer_expire* ea = (const struct timer_expire*)a;
+    const struct timer_expire* eb = (const struct timer_expire*)b;
+    if(ea->data.handle != eb->data.handle) {
+        return (ea->data.handle < eb->data.handle)?(-1):(1);
+    }
+    if(ea->expire != eb->expire) {
+        return time_before(ea->expire, eb->expire)?(-1):(1);
     }
+    return (ea->seq < eb->seq)?(-1):((ea->seq > eb->seq)?(1):(0));
 }
 
 static void
-_timer_dispatch(struct timer_state* state, struct timer_node* node) {
-    uint32_t cur_time = state->cur_time;
-    int session = node->data.session;
-    uint32_t handle = node->data.handle;
-    assert(cur_time == node->expire);
-    hive_send(SYS_HANDLE, handle, HIVE_TTIMER, session, NULL, 0);
+_expire_reserve(struct timer_state* state, size_t count) {
+    size_t size = state->expired.size;
+    if(count <= size) {
+        return;
+    }
+    while(size < count) {
+        size *= 2;
+    }
+    state->expired.slots = (struct timer_expire*)hive_realloc(state->expired.slots, sizeof(struct timer_expire)*size);
+    state->expired.sessions = (int*)hive_realloc(state->expired.sessions, sizeof(int)*2*size);
+    state->expired.size = size;
+}
+
+// the expired timers of all shards are merged, timers of same actor are send by one message
+static void
+_timer_dispatch(struct timer_state* state) {
+    size_t count = state->expired.count;
+    struct timer_expire* slots = state->expired.slots;
+    if(count > 1) {
+        qsort(slots, count, sizeof(struct timer_expire), _expire_cmp);
+    }
+
+    size_t i=0;
+    while(i<count) {
+        uint32_t handle = slots[i].data.handle;
+        int* sessions = state->expired.sessions;
+        size_t n = 0;
+        while(i+n < count && slots[i+n].data.handle == handle) {
+            sessions[2*n] = slots[i+n].data.session;
+            sessions[2*n+1] = (int)slots[i+n].count;
+            n++;
+        }
+
+        if(n == 1 && slots[i].count == 1) {
+            hive_send(SYS_HANDLE, handle, HIVE_TTIMER, slots[i].data.session, NULL, 0);
+        }else {
+            hive_send(SYS_HANDLE, handle, HIVE_TTIMER, (int)n, sessions, sizeof(int)*2*n);
+        }
+        i += n;
+    }
+    state->expired.count = 0;
 }
 
 
 static void
-_hive_timer_exec(struct timer_state* state) {
-    uint32_t cur_time = state->cur_time;
+_hive_timer_exec(struct timer_state* state, struct timer_shard* shard) {
+    uint32_t cur_time = shard->cur_time;
     int idx = cur_time & NEAR_MASK;
 
-    struct timer_list* list = &state->near_wheel[idx];
+    struct timer_list* list = &shard->near_wheel[idx];
     struct timer_node* node = list->head;
+    list->head = NULL;
+    list->tail = NULL;
 
     while(node) {
-        list->tail = NULL;
-        list->head = NULL;
-
-        spinlock_unlock(&state->lock);
-        while(node) {
-            _timer_dispatch(state, node);
-            struct timer_node* next = node->next;
-            _node_free(node);
-            node = next;
+        assert(cur_time == node->expire);
+        struct timer_node* next = node->next;
+
+        size_t count = state->expired.count;
+        _expire_reserve(state, count+1);
+        struct timer_expire* expire = &(state->expired.slots[count]);
+        expire->data = node->data;
+        expire->expire = node->expire;
+        expire->count = 1;
+        expire->seq = count;
+        state->expired.count = count+1;
+
+        if(node->interval > 0) {
+            // re-arm in place, the periods missed by catching up are fold into count
+            uint32_t interval = node->interval;
+            expire->count += (state->real_tick - cur_time) / interval;
+            node->expire = cur_time + expire->count * interval;
+            _hive_timer_add(shard, node);
+        }else {
+            _index_remove(state, shard, node->data.session);
+            _node_free(shard, node);
+            shard->count--;
         }
-        spinlock_lock(&state->lock);
-        node = list->head;
+        node = next;
     }
 }
 
 static void
-_timer_move(struct timer_state* state, int level, int idx) {
-    struct timer_list* list = &state->level_wheel[level][idx];
+_timer_move(struct timer_shard* shard, int level, int idx) {
+    struct timer_list* list = &shard->level_wheel[level][idx];
     struct timer_node* head = list->head;
     list->head = NULL;
     list->tail = NULL;
     while(head) {
         struct timer_node* next = head->next;
-        _hive_timer_add(state, head);
+        _hive_timer_add(shard, head);
         head = next;
     }
 }
 
 
 static void
-_hive_timer_shift(struct timer_state* state) {
-    uint32_t time = ++state->cur_time;
+_hive_timer_shift(struct timer_shard* shard) {
+    uint32_t time = ++shard->cur_time;
     if(time == 0) {
-        _timer_move(state, 3, 0);
+        _timer_move(shard, 3, 0);
     } else {
         int i=0;
         uint32_t ct = time >> NEAR_SHIFT;
-        uint32_t mask = NEAR_SHIFT;
+        uint32_t mask = NEAR;
         while((time & (mask-1)) == 0) {
             int idx = ct & LEVEL_MASK;
             if(idx != 0) {
-                _timer_move(state, i, idx);
+                _timer_move(shard, i, idx);
                 break;
             }
             i++;
@@ -217,40 +538,220 @@ _hive_timer_shift(struct timer_state* state) {
 
 
 
+// advance one shard to real tick in one lock, the empty near slots are skipped in bulk.
 static void
-_timer_update(struct timer_state* state) {
-    spinlock_lock(&state->lock);
-    _hive_timer_exec(state);
-    _hive_timer_shift(state);
-    _hive_timer_exec(state);
-    spinlock_unlock(&state->lock);
+_timer_update(struct timer_state* state, struct timer_shard* shard) {
+    spinlock_lock(&shard->lock);
+    uint32_t ticks = state->real_tick - shard->cur_time;
+    _hive_timer_exec(state, shard);
+    while(ticks > 0) {
+        uint32_t cur_time = shard->cur_time;
+        uint32_t skip = 0;
+        if(shard->count == 0) {
+            skip = ticks - 1;
+        }else {
+            while(skip < ticks - 1) {
+                uint32_t time = cur_time + skip + 1;
+                if((time & NEAR_MASK) == 0 || shard->near_wheel[time & NEAR_MASK].head) {
+                    break;
+                }
+                skip++;
+            }
+        }
+        shard->cur_time = cur_time + skip;
+        ticks -= skip;
+
+        _hive_timer_shift(shard);
+        _hive_timer_exec(state, shard);
+        ticks--;
+    }
+    spinlock_unlock(&shard->lock);
 }
 
 void 
 hive_timer_update(struct timer_state* state) {
-    uint64_t cur_real_time = hive_timer_gettime();
-    uint64_t last_real_time = state->last_real_time;
+    uint64_t cur_real_time = _clock_ms(state->clock_id);
+    uint32_t resolution = state->resolution;
+    if(cur_real_time <= state->last_real_time ||
+       cur_real_time/resolution == state->last_real_time/resolution) {
+        return;
+    }
     state->last_real_time = cur_real_time;
-    if(cur_real_time < last_real_time) {
-        actor_log_send(SYS_HANDLE, HIVE_LOG_ERR, "invalid timer diff");
-    }else {
-        uint64_t diff = cur_real_time/10 - last_real_time/10; // 10 ms
-        uint64_t i=0;
-        for(i=0; i<diff; i++) {
-            _timer_update(state);
-        }
+    state->real_tick = (uint32_t)(cur_real_time/resolution - state->start_tick);
+
+    uint32_t shard_size = 1<<state->shard_bits;
+    uint32_t i=0;
+    for(i=0; i<shard_size; i++) {
+        _timer_update(state, &state->shards[i]);
     }
+    _timer_dispatch(state);
 }
 
 
+static inline bool
+_need_wakeup(uint64_t sleep, uint32_t expire) {
+    uint32_t st = (uint32_t)(sleep >> 32);
+    return st == SLEEP_FOREVER || (st == SLEEP_UNTIL && time_before(expire, (uint32_t)sleep));
+}
+
+// wake up the sleeping timer thread if the new timer expire before it.
+static void
+_timer_notify(struct timer_state* state, uint32_t expire) {
+    // pair with the barrier of hive_timer_wait, either it see the new node or we see it sleep
+    __sync_synchronize();
+    if(!_need_wakeup(*(volatile uint64_t*)&state->sleep, expire)) {
+        return;
+    }
+
+    pthread_mutex_lock(&state->mutex);
+    if(_need_wakeup(state->sleep, expire)) {
+        state->wakeup = true;
+        pthread_cond_signal(&state->cond);
+    }
+    pthread_mutex_unlock(&state->mutex);
+}
+
+static inline struct timer_shard*
+_thread_shard(struct timer_state* state, uint32_t* out_idx) {
+    if(THREAD_SHARD < 0) {
+        THREAD_SHARD = ATOM_FINC(&state->shard_next);
+    }
+    uint32_t idx = (uint32_t)THREAD_SHARD & shard_mask(state);
+    *out_idx = idx;
+    return &state->shards[idx];
+}
+
 int
-hive_timer_insert(struct timer_state* state, uint32_t offset, uint32_t handle) {
-    spinlock_lock(&state->lock);
-    int session = state->session++;
-    struct timer_node* node = _node_new(state, offset, session, handle);
-    _hive_timer_add(state, node);
-    spinlock_unlock(&state->lock);
+hive_timer_insert(struct timer_state* state, uint32_t offset, uint32_t interval, uint32_t handle) {
+    uint32_t expire = _timer_curtick(state) + offset;
+    uint32_t idx = 0;
+    struct timer_shard* shard = _thread_shard(state, &idx);
+
+    spinlock_lock(&shard->lock);
+    int session = (int)(((shard->seq++ << state->shard_bits) | idx) & 0x7fffffff);
+    // the clock may be read before timer thread advance this shard
+    if(time_before(expire, shard->cur_time)) {
+        expire = shard->cur_time;
+    }
+    struct timer_node* node = _node_new(shard, expire, interval, session, handle);
+    _hive_timer_add(shard, node);
+    _index_insert(state, shard, node);
+    shard->count++;
+    spinlock_unlock(&shard->lock);
+
+    _timer_notify(state, expire);
     return session;
 }
 
 
+bool
+hive_timer_remove(struct timer_state* state, int session, uint32_t handle) {
+    struct timer_shard* shard = &state->shards[(uint32_t)session & shard_mask(state)];
+    spinlock_lock(&shard->lock);
+    struct timer_node* node = _index_query(state, shard, session);
+    if(node == NULL || node->data.handle != handle) {
+        spinlock_unlock(&shard->lock);
+        return false;
+    }
+
+    _index_remove(state, shard, session);
+    _list_remove(node->list, node);
+    _node_free(shard, node);
+    shard->count--;
+    spinlock_unlock(&shard->lock);
+    return true;
+}
+
+
+// get the tick time of next expire of one shard, only check near wheel.
+// if near wheel is empty, wake up at the next level shift.
+static bool
+_shard_next(struct timer_shard* shard, uint32_t* out_time) {
+    if(shard->count == 0) {
+        return false;
+    }
+
+    uint32_t cur_time = shard->cur_time;
+    if(shard->near_wheel[cur_time & NEAR_MASK].head) {
+        *out_time = cur_time + 1;
+        return true;
+    }
+
+    uint32_t end = (cur_time | NEAR_MASK) + 1;
+    uint32_t time = 0;
+    for(time=cur_time+1; time!=end; time++) {
+        if(shard->near_wheel[time & NEAR_MASK].head) {
+            break;
+        }
+    }
+    *out_time = time;
+    return true;
+}
+
+static bool
+_timer_next(struct timer_state* state, uint32_t* out_time) {
+    bool ret = false;
+    uint32_t shard_size = 1<<state->shard_bits;
+    uint32_t i=0;
+    for(i=0; i<shard_size; i++) {
+        struct timer_shard* shard = &state->shards[i];
+        uint32_t time = 0;
+        spinlock_lock(&shard->lock);
+        bool has = _shard_next(shard, &time);
+        spinlock_unlock(&shard->lock);
+        if(has && (!ret || time_before(time, *out_time))) {
+            *out_time = time;
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+
+void
+hive_timer_wait(struct timer_state* state) {
+    pthread_mutex_lock(&state->mutex);
+    // announce sleep before scan the shards, insert during scan will wait the mutex
+    state->sleep = sleep_word(SLEEP_FOREVER, 0);
+    __sync_synchronize();
+    uint32_t wakeup_time = 0;
+    bool forever = !_timer_next(state, &wakeup_time);
+    if(!forever) {
+        state->sleep = sleep_word(SLEEP_UNTIL, wakeup_time);
+    }
+    uint32_t resolution = state->resolution;
+    uint64_t deadline = (state->last_real_time/resolution + (wakeup_time - state->real_tick)) * resolution;
+
+    struct timespec ts;
+#ifdef __APPLE__
+    uint64_t now = _clock_ms(state->clock_id);
+    uint64_t delay = (deadline > now)?(deadline - now):(0);
+    ts.tv_sec = delay / 1000;
+    ts.tv_nsec = (delay % 1000) * 1000000;
+    #define cond_timedwait(cond, mutex, ts) pthread_cond_timedwait_relative_np(cond, mutex, ts)
+#else
+    ts.tv_sec = deadline / 1000;
+    ts.tv_nsec = (deadline % 1000) * 1000000;
+    #define cond_timedwait(cond, mutex, ts) pthread_cond_timedwait(cond, mutex, ts)
+#endif
+    while(!state->wakeup) {
+        if(forever) {
+            pthread_cond_wait(&state->cond, &state->mutex);
+        }else if(cond_timedwait(&state->cond, &state->mutex, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    state->sleep = sleep_word(SLEEP_NONE, 0);
+    state->wakeup = false;
+    pthread_mutex_unlock(&state->mutex);
+}
+
+
+void
+hive_timer_wakeup(struct timer_state* state) {
+    pthread_mutex_lock(&state->mutex);
+    state->wakeup = true;
+    pthread_cond_signal(&state->cond);
+    pthread_mutex_unlock(&state->mutex);
+}
@@ -1,15 +1,24 @@
 #ifndef _HIVE_TIMER_H_
 #define _HIVE_TIMER_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 struct timer_state;
 
-struct timer_state* hive_timer_create();
+// one wheel shard per shard_count threads, rounded up to power of 2
+struct timer_state* hive_timer_create(uint32_t resolution, int shard_count);
 void hive_timer_free(struct timer_state* state);
 void hive_timer_update(struct timer_state* state);
-int hive_timer_insert(struct timer_state* state, uint32_t offset, uint32_t handle);
+// interval > 0 re-arm the timer every interval ticks until it is removed
+int hive_timer_insert(struct timer_state* state, uint32_t offset, uint32_t interval, uint32_t handle);
+bool hive_timer_remove(struct timer_state* state, int session, uint32_t handle);
+uint32_t hive_timer_resolution(struct timer_state* state);
 uint64_t hive_timer_gettime();
 
+// sleep until next timer is expired, or insert an earlier timer, or hive_timer_wakeup
+void hive_timer_wait(struct timer_state* state);
+void hive_timer_wakeup(struct timer_state* state);
+
 #endif
\ No newline at end of file
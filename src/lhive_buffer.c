@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_LUA
 #include "hive_memory.h"
 #include "lhive_buffer.h"
 
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_LUA
 #include "hive_memory.h"
 #include "lhive_pack.h"
 
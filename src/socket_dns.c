@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_SOCKET
+#include "hive_memory.h"
+#include "socket_dns.h"
+
+#define DNS_CACHE_SLOT 256
+#define MAX_DNS_CACHE 4096
+
+struct dns_entry {
+    struct dns_entry* next;
+    struct dns_entry* lru_prev; // the recently used one is at head
+    struct dns_entry* lru_next;
+    uint32_t slot;
+    uint64_t expire;
+    int count;
+    struct dns_addr addrs[MAX_DNS_ADDR];
+    char host[0];
+};
+
+struct dns_cache {
+    pthread_mutex_t lock;
+    uint64_t ttl;
+    int count;
+    struct dns_entry* lru_head;
+    struct dns_entry* lru_tail;
+    struct dns_entry* slots[DNS_CACHE_SLOT];
+};
+
+
+static uint64_t
+_now() {
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    return (uint64_t)ti.tv_sec*1000 + ti.tv_nsec/1000000;
+}
+
+
+static uint32_t
+_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    for(; *s; s++) {
+        h = (h ^ (uint8_t)*s) * 16777619u;
+    }
+    return h;
+}
+
+
+struct dns_cache*
+dns_cache_create(int ttl) {
+    struct dns_cache* cache = (struct dns_cache*)hive_malloc(sizeof(struct dns_cache));
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->ttl = (uint64_t)ttl*1000;
+    return cache;
+}
+
+
+static void
+_cache_clear(struct dns_cache* cache) {
+    int i;
+    for(i=0; i<DNS_CACHE_SLOT; i++) {
+        struct dns_entry* p = cache->slots[i];
+        while(p) {
+            struct dns_entry* next = p->next;
+            hive_free(p);
+            p = next;
+        }
+        cache->slots[i] = NULL;
+    }
+    cache->count = 0;
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+}
+
+
+void
+dns_cache_release(struct dns_cache* cache) {
+    _cache_clear(cache);
+    pthread_mutex_destroy(&cache->lock);
+    hive_free(cache);
+}
+
+
+bool
+dns_is_numeric(const char* host) {
+    struct in6_addr addr;
+    return inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1;
+}
+
+
+static void
+_set_port(struct dns_addr* addr, uint16_t port) {
+    if(addr->family == AF_INET) {
+        ((struct sockaddr_in*)&addr->addr)->sin_port = htons(port);
+    }else if(addr->family == AF_INET6) {
+        ((struct sockaddr_in6*)&addr->addr)->sin6_port = htons(port);
+    }
+}
+
+
+static void
+_lru_unlink(struct dns_cache* cache, struct dns_entry* e) {
+    if(e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    }else {
+        cache->lru_head = e->lru_next;
+    }
+    if(e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    }else {
+        cache->lru_tail = e->lru_prev;
+    }
+    e->lru_prev = NULL;
+    e->lru_next = NULL;
+}
+
+
+static void
+_lru_push(struct dns_cache* cache, struct dns_entry* e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if(cache->lru_head) {
+        cache->lru_head->lru_prev = e;
+    }else {
+        cache->lru_tail = e;
+    }
+    cache->lru_head = e;
+}
+
+
+// drop the expired entries of the slot, return the live one of host. must hold lock
+static struct dns_entry*
+_cache_query(struct dns_cache* cache, uint32_t slot, const char* host, uint64_t now) {
+    struct dns_entry** pp = &cache->slots[slot];
+    struct dns_entry* found = NULL;
+    while(*pp) {
+        struct dns_entry* p = *pp;
+        if(p->expire <= now) {
+            *pp = p->next;
+            _lru_unlink(cache, p);
+            cache->count--;
+            hive_free(p);
+            continue;
+        }
+        if(host && strcmp(p->host, host) == 0) {
+            found = p;
+        }
+        pp = &p->next;
+    }
+    return found;
+}
+
+
+// make room for a new entry, the expired entries go first, then the least recently used one
+static void
+_cache_evict(struct dns_cache* cache, uint64_t now) {
+    uint32_t i;
+    for(i=0; i<DNS_CACHE_SLOT && cache->count >= MAX_DNS_CACHE; i++) {
+        _cache_query(cache, i, NULL, now);
+    }
+    while(cache->count >= MAX_DNS_CACHE) {
+        struct dns_entry* e = cache->lru_tail;
+        struct dns_entry** pp = &cache->slots[e->slot];
+        while(*pp != e) {
+            pp = &(*pp)->next;
+        }
+        *pp = e->next;
+        _lru_unlink(cache, e);
+        cache->count--;
+        hive_free(e);
+    }
+}
+
+
+int
+dns_resolve(struct dns_cache* cache, const char* host, uint16_t port,
+    struct dns_addr* out, int max, const char** out_err) {
+    bool numeric = dns_is_numeric(host);
+    uint32_t slot = _hash(host) % DNS_CACHE_SLOT;
+    int i, n = 0;
+
+    if(!numeric && cache->ttl > 0) {
+        pthread_mutex_lock(&cache->lock);
+        struct dns_entry* e = _cache_query(cache, slot, host, _now());
+        if(e) {
+            _lru_unlink(cache, e);
+            _lru_push(cache, e);
+            n = (e->count < max)?(e->count):(max);
+            memcpy(out, e->addrs, sizeof(struct dns_addr)*n);
+        }
+        pthread_mutex_unlock(&cache->lock);
+        if(n > 0) {
+            for(i=0; i<n; i++) {
+                _set_port(&out[i], port);
+            }
+            return n;
+        }
+    }
+
+    struct addrinfo ai_hints = {0};
+    struct addrinfo* ai_list = NULL;
+    ai_hints.ai_protocol = IPPROTO_TCP;
+    ai_hints.ai_family = AF_UNSPEC;
+    ai_hints.ai_socktype = SOCK_STREAM;
+    ai_hints.ai_flags = (numeric)?(AI_NUMERICHOST):(0);
+    int status = getaddrinfo(host, NULL, &ai_hints, &ai_list);
+    if(status != 0) {
+        *out_err = gai_strerror(status);
+        return -1;
+    }
+
+    struct addrinfo* ai_ptr;
+    for(ai_ptr=ai_list; ai_ptr != NULL && n < max && n < MAX_DNS_ADDR; ai_ptr = ai_ptr->ai_next) {
+        if(ai_ptr->ai_addrlen > sizeof(out[n].addr)) {
+            continue;
+        }
+        out[n].family = ai_ptr->ai_family;
+        out[n].len = ai_ptr->ai_addrlen;
+        memcpy(&out[n].addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        n++;
+    }
+    freeaddrinfo(ai_list);
+    if(n == 0) {
+        *out_err = "no tcp address";
+        return -1;
+    }
+
+    if(!numeric && cache->ttl > 0) {
+        size_t len = strlen(host);
+        struct dns_entry* e = (struct dns_entry*)hive_malloc(sizeof(struct dns_entry) + len + 1);
+        memcpy(e->host, host, len + 1);
+        memcpy(e->addrs, out, sizeof(struct dns_addr)*n);
+        e->count = n;
+        e->slot = slot;
+        pthread_mutex_lock(&cache->lock);
+        uint64_t now = _now();
+        e->expire = now + cache->ttl;
+        struct dns_entry* old = _cache_query(cache, slot, host, now);
+        if(old) {
+            // resolved by other thread at the same time
+            hive_free(e);
+        }else {
+            if(cache->count >= MAX_DNS_CACHE) {
+                _cache_evict(cache, now);
+            }
+            e->next = cache->slots[slot];
+            cache->slots[slot] = e;
+            _lru_push(cache, e);
+            cache->count++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    for(i=0; i<n; i++) {
+        _set_port(&out[i], port);
+    }
+    return n;
+}
@@ -0,0 +1,31 @@
+#ifndef _SOCKET_DNS_H_
+#define _SOCKET_DNS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define MAX_DNS_ADDR 8
+
+struct dns_addr {
+    int family;
+    socklen_t len;
+    struct sockaddr_storage addr;
+};
+
+struct dns_cache;
+
+// resolved addresses of a host are kept ttl seconds
+struct dns_cache* dns_cache_create(int ttl);
+void dns_cache_release(struct dns_cache* cache);
+
+// numeric host is resolved without blocking and never cached
+bool dns_is_numeric(const char* host);
+
+// return the count of tcp address with port, or -1 and out_err.
+// it is thread safe and may block at getaddrinfo.
+int dns_resolve(struct dns_cache* cache, const char* host, uint16_t port,
+    struct dns_addr* out, int max, const char** out_err);
+
+#endif
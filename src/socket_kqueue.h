@@ -38,37 +38,26 @@ sp_del(int kfd, int sock) {
 static int 
 sp_add(int kfd, int sock, void *ud) {
 	struct kevent ke;
-	EV_SET(&ke, sock, EVFILT_READ, EV_ADD, 0, 0, ud);
+	EV_SET(&ke, sock, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, ud);
 	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1 ||	ke.flags & EV_ERROR) {
 		return 1;
 	}
-	EV_SET(&ke, sock, EVFILT_WRITE, EV_ADD, 0, 0, ud);
+	EV_SET(&ke, sock, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, ud);
 	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1 ||	ke.flags & EV_ERROR) {
 		EV_SET(&ke, sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
 		kevent(kfd, &ke, 1, NULL, 0, NULL);
 		return 1;
 	}
-	EV_SET(&ke, sock, EVFILT_WRITE, EV_DISABLE, 0, 0, ud);
-	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1 ||	ke.flags & EV_ERROR) {
-		sp_del(kfd, sock);
-		return 1;
-	}
 	return 0;
 }
 
-static void 
-sp_write(int kfd, int sock, void *ud, bool enable) {
-	struct kevent ke;
-	EV_SET(&ke, sock, EVFILT_WRITE, enable ? EV_ENABLE : EV_DISABLE, 0, 0, ud);
-	if (kevent(kfd, &ke, 1, NULL, 0, NULL) == -1 || ke.flags & EV_ERROR) {
-		// todo: check error
-	}
-}
-
 static int 
-sp_wait(int kfd, struct event *e, int max) {
+sp_wait(int kfd, struct event *e, int max, int timeout) {
 	struct kevent ev[max];
-	int n = kevent(kfd, NULL, 0, ev, max, NULL);
+	struct timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	int n = kevent(kfd, NULL, 0, ev, max, (timeout < 0)?(NULL):(&ts));
 
 	int i;
 	for (i=0;i<n;i++) {
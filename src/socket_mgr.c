@@ -1,5 +1,13 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // accept4, recvmmsg and sendmmsg
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -7,29 +15,83 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "hive.h"
-#include "socket_poll.h"
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_SOCKET
 #include "hive_memory.h"
+#include "socket_poll.h"
 #include "atomic.h"
 #include "spinlock.h"
 #include "socket_mgr.h"
+#include "socket_dns.h"
 #include "hive_log.h"
 
-#define MAX_SOCKETS_SLOT (1<<16)
+// socket slots are allocated by chunk when the free list is empty
+#define SOCKET_CHUNK_BITS 10
+#define SOCKET_CHUNK_SIZE (1<<SOCKET_CHUNK_BITS)
+#define MIN_SOCKET_SLOT SOCKET_CHUNK_SIZE
+// a slot is reused after its generation wrap, keep enough bits of it in the id
+#define MIN_SOCKET_GEN_BITS 12
+#define MAX_SOCKET_SLOT (1<<(31-MIN_SOCKET_GEN_BITS))
+#define MAX_SOCKET_THREAD 64
 #define MAX_SP_EVENT 64
-#define MAX_RECV_BUFFER 64*1024*1024
+#define MAX_ACCEPT_BATCH 64
+#define DEFAULT_BACKLOG 128
+// datagrams moved by one recvmmsg and sendmmsg
+#define MAX_UDP_RECV 16
+#define MAX_UDP_SEND 64
+#define MAX_UDP_PACKET 65536
+#ifdef IOV_MAX
+    #define MAX_SEND_IOV IOV_MAX
+#else
+    #define MAX_SEND_IOV 1024
+#endif
+// receive buffer size of a socket is adapted between min and max
+#define MIN_RECV_BUFFER 512
+#define MAX_RECV_BUFFER (1024*1024)
+#define DEFAULT_RECV_BUFFER 4096
+// buffer provided to multishot recv of io_uring, the half filled one is given to actor
+#define URING_RECV_BUFFER 16384
+// blocks of write buffer sent by one linked chain
+#define MAX_URING_SEND 64
+#define MAX_NOTIFY_STRING 256
+#define MAX_ERROR_STRING 128
+#define MAX_RESOLVER_THREAD 16
+#define DNS_CACHE_TTL 60    // seconds
+// timeout wheel of socket thread, a deadline beyond one round waits more rounds
+#define TIMEOUT_TICK 100    // ms
+#define TIMEOUT_WHEEL_SIZE 512
+#define TIMEOUT_RUNNING (-2)    // timeout_slot of the socket in the slot list being checked
+// bytes moved by one splice, it is the default capacity of linux pipe
+#define RELAY_PIPE_SIZE 65536
+
+// relay of two sockets, the one not on the thread of peer move to it first.
+// the linked sockets hold until the actor flush the data received before the link.
+enum relay_state {
+    RELAY_NONE,
+    RELAY_MOVE,
+    RELAY_HOLD,
+    RELAY_RUN,
+};
 
 enum socket_type {
     ST_INVALID,
     ST_PREPARE,
+    ST_RESOLVING,   // connect is waiting the host resolved by resolver thread
 
     ST_LISTEN,
     ST_CONNECTING,
     ST_CONNECTED,
     ST_FORWARD,
+    ST_UDP,
 
     _ST_COUNT,
 };
@@ -46,12 +108,73 @@ struct buffer_block {
     uint8_t buffer[0];
 };
 
+// the block of udp socket is one datagram, it begin with udp_head and offset is the datagram
+struct udp_head {
+    socklen_t addr_len;
+    struct sockaddr_storage addr;
+};
+
 struct socket {
     int fd;
-    int id;
+    int id;             // generation<<index_bits | slot index
+    int index;          // slot index
+    uint32_t gen;       // generation of slot, increased at every reuse
+    int free_next;      // next free slot index
+    int thread;         // index of socket thread which own the socket
+    int listen_id;      // the listener id report to actor, listeners of all threads share it
+    int listen_next;    // next listener of the same port
     enum socket_type type;
     uint32_t actor_handle;
+    uint32_t attach_handle; // listener attach accepted socket to it, SYS_HANDLE is not
     struct spinlock lock;
+    int send_pending;   // send requests not appended to write buffer yet
+    size_t send_queued; // bytes of send requests and write buffer
+    size_t send_high;   // notify SE_CONGESTED when send_queued reach it, 0 is disable
+    size_t send_low;    // notify SE_WRITABLE when send_queued of congested socket drop to it
+    bool congested;     // only socket thread touch it
+    int paused;         // stop reading, data is left in kernel so the tcp window push back
+    size_t recv_size;   // read size of next receive buffer
+
+    // timeouts in ms, 0 is disable. only socket thread touch them except created
+    int connect_timeout;    // from created until connected
+    int read_timeout;       // nothing is read
+    int write_timeout;      // queued data is not written
+    uint64_t created;
+    uint64_t last_read;
+    uint64_t last_write;
+    uint64_t timeout_expire;    // the wheel check it at expire, then reschedule by the deadline
+    uint64_t accept_retry;      // ms, the listener accept again when accept is failed, 0 is none
+    int timeout_slot;           // slot of wheel, -1 is not in wheel
+    struct socket* timeout_prev;
+    struct socket* timeout_next;
+
+    // relay data to peer in socket thread, only socket thread touch them
+    int relay_id;               // linked peer, -1 is not relayed
+    enum relay_state relay_state;
+    bool relay_master;          // the socket relay is requested on, the end is notified by it
+    bool relay_eof;             // read eof, the write side of peer is shut down
+#ifdef __linux__
+    int relay_pipe[2];          // data spliced from this socket and not written to peer yet
+#else
+    uint8_t* relay_buffer;
+    size_t relay_offset;
+#endif
+    size_t relay_piped;
+    uint64_t relay_bytes;       // bytes written to peer
+
+#ifdef SP_IO_URING
+    // completion ops of io_uring, only socket thread touch them
+    int uring_ops;              // ops not completed yet, a closed socket keep its slot until they are done
+    int uring_sending;          // blocks at head of write buffer in the send chain
+    bool uring_accept;          // multishot accept is armed
+    bool uring_recv;            // multishot recv is armed
+    bool uring_cancel;          // the recv is canceled
+    bool uring_hold;            // recv is not armed again, the socket is going to relay
+    struct request_package* uring_defer;    // the relay request run again when the ops are done
+    bool uring_pending;         // an op is not queued for the full submission ring, armed again by the loop
+    struct socket* uring_pending_next;
+#endif
+
     struct {
         struct buffer_block* head;
         struct buffer_block* tail;
@@ -59,22 +182,79 @@ struct socket {
 };
 
 
-struct socket_mgr_state {
+// every socket thread has its own poll set and request queue
+struct socket_thread {
     poll_fd pfd;
+    // doorbell of request queue, eventfd or pipe
     int recvctrl_fd;
     int sendctrl_fd;
-    int socket_index;
-    struct socket socket_slots[MAX_SOCKETS_SLOT];
+    struct request_package* request_head;   // lock free stack, pushed by other threads
     struct event  sp_event[MAX_SP_EVENT];
 
-    char _addr_buffer[2048];
-    struct socket_data* _recv_data;
+    // the receive buffer is given to actor, the one not filled is kept for next read
+    struct {
+        struct socket_data* data;
+        size_t size;
+    } spare_recv;
+
+    uint8_t* udp_recv;  // MAX_UDP_RECV packets, allocated by the first udp read
+    int reserve_fd;     // given up to accept when fd is exhausted, -1 is lost
+#ifdef SP_IO_URING
+    struct socket_data** uring_buffers;  // provided to multishot recv, indexed by buffer id
+    struct socket* uring_pending;        // sockets waiting for the submission ring
+#endif
 
     struct {
         struct socket** slots;
         size_t size;
         size_t idx;
     } prepare_close_sockets;
+
+    struct {
+        uint64_t now;   // ms, updated after every wait
+        uint64_t tick;  // the next tick to run
+        int count;
+        struct socket* running; // the slot list taken out to check
+        struct socket* slots[TIMEOUT_WHEEL_SIZE];
+    } wheel;
+};
+
+struct resolve_job {
+    struct resolve_job* next;
+    int id;
+    uint16_t port;
+    struct socket_opt opt;
+    char host[0];
+};
+
+struct socket_mgr_state {
+    int thread_count;
+    int thread_index;   // round robin thread of connect
+    struct socket_thread* threads;
+
+    // slot table, chunks are allocated until slot_cap
+    struct spinlock slot_lock;
+    int slot_cap;
+    int slot_count;
+    int index_bits;
+    int chunk_count;
+    struct socket** chunks;
+    int free_head;      // fifo free list, reuse the slot freed earliest
+    int free_tail;
+    struct socket invalid_socket;   // looked up by the id of an unallocated chunk
+
+    // resolver threads resolve host name of connect, then connect it
+    struct {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct resolve_job* head;
+        struct resolve_job* tail;
+        bool exit;
+        int thread_count;
+        struct dns_cache* cache;
+    } resolver;
+
+    char _addr_buffer[2048];
 };
 
 
@@ -85,6 +265,11 @@ enum request_type {
     REQ_CLOSE,
     REQ_ATTACH,
     REQ_SEND,
+    REQ_RESUME,
+    REQ_TIMEOUT,
+    REQ_WATERMARK,
+    REQ_RELAY,
+    REQ_RELAY_START,
 
     REQ_EXIT,
 };
@@ -93,106 +278,368 @@ struct request_msgsend {
     struct buffer_block* block;
 };
 
+struct request_timeout {
+    int connect;
+    int read;
+    int write;
+};
+
+struct request_watermark {
+    size_t high;
+    size_t low;
+};
+
 struct request_package {
+    struct request_package* next;
     enum request_type type;
     int socket_id;
     union {
         struct request_msgsend msgsend;
+        struct request_timeout timeout;
+        struct request_watermark watermark;
         uint32_t attach_handle;
+        int relay_id;
     } v;
 };
 
 #define sm_log(...) hive_elog("hive socket_mgr", __VA_ARGS__)
 
-#define id2hash(i) ((i)%MAX_SOCKETS_SLOT)
-#define get_socket(id) &(state->socket_slots[id2hash(id)])
+#define get_socket(id) _socket_get(state, id)
+#define get_thread(s) (&(state->threads[(s)->thread]))
 #define PKG_SIZE sizeof(struct request_package)
 #define write_buffer_empty(s) ((s)->write_buffer.tail==NULL)
 
 static void _socket_free(struct socket* s);
 static void _buffer_free(struct socket* s);
+static void _relay_free(struct socket* s);
+static struct socket* _relay_close(struct socket_mgr_state* state, struct socket* s, const char* err);
 static const char* _socket_check_error(struct socket* s);
 
 static int _socket_getaddr(struct socket_mgr_state* state, struct socket* s, struct socket_addrinfo* out_addrinfo, const char** out_error);
 
-static void _actor_notify_accept(int server_id, int client_id, uint32_t target_handle);
+static void _actor_notify_accept(int server_id, const int* client_ids, int count, uint32_t target_handle);
 static void _actor_notify_break(struct socket* s);
-static void _actor_notify_error(struct socket_mgr_state* state, struct socket* s, size_t size);
-static void _actor_notify_recv(struct socket_mgr_state* state, struct socket* s, size_t size);
-static void _actor_notify_connected(struct socket_mgr_state* state, struct socket* s, const char* err);
+static void _actor_notify_error(struct socket* s, const char* err);
+static void _actor_notify_recv(struct socket* s, struct socket_data* data, size_t size);
+static void _actor_notify_connected(struct socket* s, const char* err);
+static void _actor_notify_watermark(struct socket* s, enum socket_event se, size_t queued);
+static void _actor_notify_udp(struct socket* s, const uint8_t* data, size_t size, const struct sockaddr_storage* addr, socklen_t addr_len);
 
-struct socket_mgr_state*
-socket_mgr_create() {
-    int i;
-    struct socket_mgr_state* state = hive_malloc(sizeof(struct socket_mgr_state));
-    state->pfd = sp_create();
-    if(sp_invalid(state->pfd)) {
-        hive_free(state);
-        return NULL;
+static void _actor_notify_relay_ready(struct socket* s);
+static void _actor_notify_relay(struct socket* s, uint64_t sent, uint64_t received, const char* err);
+
+static void _timeout_unlink(struct socket_thread* t, struct socket* s);
+static void _timeout_schedule(struct socket_thread* t, struct socket* s);
+
+#ifdef SP_IO_URING
+static void _uring_accept(struct socket_mgr_state* state, struct socket* s);
+static void _uring_recv(struct socket_mgr_state* state, struct socket* s);
+static void _uring_send(struct socket_mgr_state* state, struct socket* s);
+static void _socket_event_clear(struct socket_thread* t, int idx, int n, struct socket* close_s);
+#endif
+
+// the error given out by pointer, it is kept until the next error of the thread
+static __thread char ERROR_BUFFER[MAX_ERROR_STRING];
+
+// strerror share its buffer between threads, write the message in buffer of caller
+static const char*
+_socket_strerror(int err, char* buffer, size_t size) {
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+    // gnu version may return a static string rather than fill buffer
+    return strerror_r(err, buffer, size);
+#else
+    if(strerror_r(err, buffer, size) != 0) {
+        snprintf(buffer, size, "unknown error %d", err);
     }
+    return buffer;
+#endif
+}
 
-    // init prepare close sockets queue
-    state->prepare_close_sockets.size = MAX_SP_EVENT;
-    state->prepare_close_sockets.idx = 0;
-    state->prepare_close_sockets.slots = (struct socket**)hive_malloc(sizeof(struct socket*)*state->prepare_close_sockets.size);
+static uint64_t
+_now() {
+    struct timespec ti;
+    clock_gettime(CLOCK_MONOTONIC, &ti);
+    return (uint64_t)ti.tv_sec*1000 + ti.tv_nsec/1000000;
+}
+
+static void
+_thread_release(struct socket_thread* t) {
+    if(t->spare_recv.data) {
+        hive_free(t->spare_recv.data);
+    }
+    if(t->udp_recv) {
+        hive_free(t->udp_recv);
+    }
+    if(t->reserve_fd >= 0) {
+        close(t->reserve_fd);
+    }
+#ifdef SP_IO_URING
+    if(t->uring_buffers) {
+        int i;
+        for(i=0; i<SP_URING_BUFFERS; i++) {
+            hive_free(t->uring_buffers[i]);
+        }
+        hive_free(t->uring_buffers);
+    }
+#endif
+
+    // free the requests left by exit
+    struct request_package* req = t->request_head;
+    while(req) {
+        struct request_package* next = req->next;
+        if(req->type == REQ_SEND) {
+            hive_free(req->v.msgsend.block);
+        }
+        hive_free(req);
+        req = next;
+    }
+
+    if(t->sendctrl_fd != t->recvctrl_fd) {
+        close(t->sendctrl_fd);
+    }
+    close(t->recvctrl_fd);
 
-    state->_recv_data = (struct socket_data*)hive_malloc(sizeof(struct socket_data) + MAX_RECV_BUFFER);
-    state->_recv_data->se = SE_RECIVE;
-    state->_recv_data->u.size = 0;
+    // free prepare close socket
+    hive_free(t->prepare_close_sockets.slots);
 
-    assert(PKG_SIZE <= 256);
+    // free socket poll
+    sp_release(t->pfd);
+}
 
-    state->socket_index = 0;
-    for(i=0; i<MAX_SOCKETS_SLOT; i++) {
-        struct socket* p = &(state->socket_slots[i]);
-        p->write_buffer.tail = NULL;
-        p->write_buffer.head = NULL;
-        p->type = ST_INVALID;
-        p->actor_handle = SYS_HANDLE;
-        spinlock_init(&p->lock);
+static bool
+_thread_init(struct socket_thread* t) {
+    t->pfd = sp_create();
+    if(sp_invalid(t->pfd)) {
+        return false;
     }
 
     int fd[2];
+#ifdef __linux__
+    fd[0] = eventfd(0, EFD_NONBLOCK);
+    fd[1] = fd[0];
+    if(fd[0] < 0) {
+        sm_log("open eventfd is error.\n");
+        sp_release(t->pfd);
+        return false;
+    }
+#else
     if(pipe(fd)) {
         sm_log("open pipe fd is error.\n");
-        hive_free(state);
-        return NULL;
+        sp_release(t->pfd);
+        return false;
     }
+    sp_nonblocking(fd[1]);
+#endif
 
-    if(sp_add(state->pfd, fd[0], NULL)) {
-        sm_log("add pipe event poll is error.\n");
+    if(sp_add(t->pfd, fd[0], NULL)) {
+        sm_log("add doorbell event poll is error.\n");
         close(fd[0]);
-        close(fd[1]);
-        hive_free(state);
-        return NULL;
+        if(fd[1] != fd[0]) {
+            close(fd[1]);
+        }
+        sp_release(t->pfd);
+        return false;
     }
 
     sp_nonblocking(fd[0]);
-    state->recvctrl_fd = fd[0];
-    state->sendctrl_fd = fd[1];
-    return state;
+    t->recvctrl_fd = fd[0];
+    t->sendctrl_fd = fd[1];
+    t->request_head = NULL;
+
+    // init prepare close sockets queue
+    t->prepare_close_sockets.size = MAX_SP_EVENT;
+    t->prepare_close_sockets.idx = 0;
+    t->prepare_close_sockets.slots = (struct socket**)hive_malloc(sizeof(struct socket*)*t->prepare_close_sockets.size);
+
+    t->spare_recv.data = NULL;
+    t->spare_recv.size = 0;
+    t->udp_recv = NULL;
+    t->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+#ifdef SP_IO_URING
+    t->uring_buffers = NULL;
+    t->uring_pending = NULL;
+    if(sp_completion(t->pfd)) {
+        int i;
+        t->uring_buffers = (struct socket_data**)hive_malloc(sizeof(struct socket_data*)*SP_URING_BUFFERS);
+        for(i=0; i<SP_URING_BUFFERS; i++) {
+            t->uring_buffers[i] = (struct socket_data*)hive_malloc(sizeof(struct socket_data) + URING_RECV_BUFFER);
+            sp_provide(t->pfd, i, t->uring_buffers[i]->data, URING_RECV_BUFFER);
+        }
+    }
+#endif
+
+    memset(&t->wheel, 0, sizeof(t->wheel));
+    t->wheel.now = _now();
+    t->wheel.tick = t->wheel.now / TIMEOUT_TICK;
+    return true;
 }
 
 
-void 
-socket_mgr_release(struct socket_mgr_state* state) {
+static void
+_socket_init(struct socket* p, int index) {
+    p->write_buffer.tail = NULL;
+    p->write_buffer.head = NULL;
+    p->type = ST_INVALID;
+    p->id = -1;
+    p->index = index;
+    p->gen = 0;
+    p->free_next = -1;
+    p->fd = -1;
+    p->actor_handle = SYS_HANDLE;
+    p->attach_handle = SYS_HANDLE;
+    p->send_pending = 0;
+    p->send_queued = 0;
+    p->send_high = 0;
+    p->send_low = 0;
+    p->congested = false;
+    p->paused = 0;
+    p->connect_timeout = 0;
+    p->read_timeout = 0;
+    p->write_timeout = 0;
+    p->created = 0;
+    p->last_read = 0;
+    p->last_write = 0;
+    p->timeout_expire = 0;
+    p->accept_retry = 0;
+    p->timeout_slot = -1;
+    p->timeout_prev = NULL;
+    p->timeout_next = NULL;
+    p->thread = 0;
+    p->listen_id = -1;
+    p->listen_next = -1;
+    p->relay_id = -1;
+    p->relay_state = RELAY_NONE;
+    p->relay_master = false;
+    p->relay_eof = false;
+#ifdef __linux__
+    p->relay_pipe[0] = -1;
+    p->relay_pipe[1] = -1;
+#else
+    p->relay_buffer = NULL;
+    p->relay_offset = 0;
+#endif
+    p->relay_piped = 0;
+    p->relay_bytes = 0;
+#ifdef SP_IO_URING
+    p->uring_ops = 0;
+    p->uring_sending = 0;
+    p->uring_accept = false;
+    p->uring_recv = false;
+    p->uring_cancel = false;
+    p->uring_hold = false;
+    p->uring_defer = NULL;
+    p->uring_pending = false;
+    p->uring_pending_next = NULL;
+#endif
+    spinlock_init(&p->lock);
+}
+
+
+struct socket_mgr_state*
+socket_mgr_create(int thread_count, int max_socket, int resolver_count) {
     int i;
-    // free socket
-    for(i=0; i<MAX_SOCKETS_SLOT; i++) {
-        struct socket* p = &(state->socket_slots[i]);
-        _socket_free(p);
+    if(thread_count < 1) {
+        thread_count = 1;
+    }else if(thread_count > MAX_SOCKET_THREAD) {
+        thread_count = MAX_SOCKET_THREAD;
+    }
+    if(resolver_count < 1) {
+        resolver_count = 1;
+    }else if(resolver_count > MAX_RESOLVER_THREAD) {
+        resolver_count = MAX_RESOLVER_THREAD;
+    }
+    if(max_socket < MIN_SOCKET_SLOT) {
+        max_socket = MIN_SOCKET_SLOT;
+    }else if(max_socket > MAX_SOCKET_SLOT) {
+        max_socket = MAX_SOCKET_SLOT;
+    }
+
+    struct socket_mgr_state* state = hive_malloc(sizeof(struct socket_mgr_state));
+    state->threads = (struct socket_thread*)hive_malloc(sizeof(struct socket_thread)*thread_count);
+    for(i=0; i<thread_count; i++) {
+        if(!_thread_init(&state->threads[i])) {
+            while(--i >= 0) {
+                _thread_release(&state->threads[i]);
+            }
+            hive_free(state->threads);
+            hive_free(state);
+            return NULL;
+        }
     }
+    state->thread_count = thread_count;
+    state->thread_index = 0;
 
-    hive_free(state->_recv_data);
+    // the rest bits of a positive int id is generation
+    int bits = SOCKET_CHUNK_BITS;
+    while((1<<bits) < max_socket) {
+        bits++;
+    }
+    assert(31 - bits >= MIN_SOCKET_GEN_BITS);
+    spinlock_init(&state->slot_lock);
+    state->slot_cap = max_socket;
+    state->slot_count = 0;
+    state->index_bits = bits;
+    state->chunk_count = (1<<bits) >> SOCKET_CHUNK_BITS;
+    state->chunks = (struct socket**)hive_malloc(sizeof(struct socket*)*state->chunk_count);
+    memset(state->chunks, 0, sizeof(struct socket*)*state->chunk_count);
+    state->free_head = -1;
+    state->free_tail = -1;
+    _socket_init(&state->invalid_socket, -1);
+
+    pthread_mutex_init(&state->resolver.lock, NULL);
+    pthread_cond_init(&state->resolver.cond, NULL);
+    state->resolver.head = NULL;
+    state->resolver.tail = NULL;
+    state->resolver.exit = false;
+    state->resolver.thread_count = resolver_count;
+    state->resolver.cache = dns_cache_create(DNS_CACHE_TTL);
+    return state;
+}
 
-    close(state->sendctrl_fd);
-    close(state->recvctrl_fd);
 
-    // free prepare close socket
-    hive_free(state->prepare_close_sockets.slots);
+int
+socket_mgr_thread_count(struct socket_mgr_state* state) {
+    return state->thread_count;
+}
 
-    // free socket poll
-    sp_release(state->pfd);
+
+int
+socket_mgr_resolver_count(struct socket_mgr_state* state) {
+    return state->resolver.thread_count;
+}
+
+
+void 
+socket_mgr_release(struct socket_mgr_state* state) {
+    int i, j;
+    // free socket
+    for(i=0; i<state->chunk_count; i++) {
+        struct socket* chunk = state->chunks[i];
+        if(chunk == NULL) {
+            continue;
+        }
+        for(j=0; j<SOCKET_CHUNK_SIZE; j++) {
+            _socket_free(&chunk[j]);
+        }
+        hive_free(chunk);
+    }
+    hive_free(state->chunks);
+
+    for(i=0; i<state->thread_count; i++) {
+        _thread_release(&state->threads[i]);
+    }
+    hive_free(state->threads);
+
+    // free resolver
+    struct resolve_job* job = state->resolver.head;
+    while(job) {
+        struct resolve_job* next = job->next;
+        hive_free(job);
+        job = next;
+    }
+    dns_cache_release(state->resolver.cache);
+    pthread_cond_destroy(&state->resolver.cond);
+    pthread_mutex_destroy(&state->resolver.lock);
 
     // free state
     hive_free(state);
@@ -201,98 +648,229 @@ socket_mgr_release(struct socket_mgr_state* state) {
 
 static void
 _socket_free(struct socket* s) {
+#ifdef SP_IO_URING
+    // no completion come after exit, free the blocks kept for the send chain
+    s->uring_sending = 0;
+    _buffer_free(s);
+    if(s->uring_defer) {
+        hive_free(s->uring_defer);
+    }
+#endif
     if(s->type != ST_INVALID) {
         int fd = s->fd;
-        int ret = close(fd);
+        int ret = (fd >= 0)?(close(fd)):(0);
         assert(ret == 0);
         _buffer_free(s);
+        _relay_free(s);
     }
 }
 
-static struct socket*
-_socket_gen(struct socket_mgr_state* state) {
+static inline struct socket*
+_socket_get(struct socket_mgr_state* state, int id) {
+    int index = id & ((1<<state->index_bits) - 1);
+    struct socket* chunk = state->chunks[index >> SOCKET_CHUNK_BITS];
+    if(chunk == NULL) {
+        return &state->invalid_socket;
+    }
+    return &chunk[index & (SOCKET_CHUNK_SIZE-1)];
+}
+
+
+// must hold slot_lock
+static void
+_slot_push_free(struct socket_mgr_state* state, struct socket* s) {
+    s->free_next = -1;
+    if(state->free_tail < 0) {
+        state->free_head = s->index;
+    }else {
+        _socket_get(state, state->free_tail)->free_next = s->index;
+    }
+    state->free_tail = s->index;
+}
+
+
+// must hold slot_lock
+static bool
+_slot_grow(struct socket_mgr_state* state) {
+    int base = state->slot_count;
+    if(base >= state->slot_cap) {
+        return false;
+    }
+    struct socket* chunk = (struct socket*)hive_malloc(sizeof(struct socket)*SOCKET_CHUNK_SIZE);
     int i;
-    for(i=0; i<MAX_SOCKETS_SLOT; i++) {
-        int id = ATOM_FINC(&state->socket_index);
-        if(id<0) {
-            id = ATOM_AND(&(state->socket_index), 0x7fffffff);
-        }
-        struct socket* s = &state->socket_slots[id2hash(id)];
-        if(s->type == ST_INVALID) {
-            if(ATOM_CAS(&(s->type), ST_INVALID, ST_PREPARE)) {
-                s->id = id;
-                s->fd = -1;
-                return s;
-            }else {
-                --i;
-            }
+    for(i=0; i<SOCKET_CHUNK_SIZE; i++) {
+        _socket_init(&chunk[i], base + i);
+    }
+    // publish the chunk before any id of it
+    __sync_synchronize();
+    state->chunks[base >> SOCKET_CHUNK_BITS] = chunk;
+    state->slot_count = base + SOCKET_CHUNK_SIZE;
+    for(i=0; i<SOCKET_CHUNK_SIZE && base + i < state->slot_cap; i++) {
+        _slot_push_free(state, &chunk[i]);
+    }
+    return true;
+}
+
+
+static struct socket*
+_socket_gen(struct socket_mgr_state* state, int thread) {
+    spinlock_lock(&state->slot_lock);
+    if(state->free_head < 0 && !_slot_grow(state)) {
+        spinlock_unlock(&state->slot_lock);
+        return NULL;
+    }
+    struct socket* s = _socket_get(state, state->free_head);
+    state->free_head = s->free_next;
+    if(state->free_head < 0) {
+        state->free_tail = -1;
+    }
+    spinlock_unlock(&state->slot_lock);
+
+    assert(s->type == ST_INVALID);
+    int gen_mask = (int)(0x7fffffffu >> state->index_bits);
+    s->gen++;
+    int id = (((int)s->gen & gen_mask) << state->index_bits) | s->index;
+    s->id = id;
+    s->fd = -1;
+    s->free_next = -1;
+    s->thread = thread;
+    s->recv_size = DEFAULT_RECV_BUFFER;
+    s->send_queued = 0;
+    s->send_high = 0;
+    s->send_low = 0;
+    s->congested = false;
+    s->paused = 0;
+    s->connect_timeout = 0;
+    s->read_timeout = 0;
+    s->write_timeout = 0;
+    s->created = _now();
+    s->last_read = s->created;
+    s->last_write = s->created;
+    s->listen_id = id;
+    s->listen_next = -1;
+#ifdef SP_IO_URING
+    s->uring_cancel = false;
+    s->uring_hold = false;
+#endif
+    s->type = ST_PREPARE;
+    return s;
+}
+
+// forward sockets and listeners are driven by the completions when io_uring is setup,
+// the others wait the readiness events.
+static void
+_socket_watch(struct socket_mgr_state* state, struct socket* s) {
+#ifdef SP_IO_URING
+    if(sp_completion(get_thread(s)->pfd)) {
+        if(s->type == ST_LISTEN) {
+            _uring_accept(state, s);
+            return;
+        }else if(s->type == ST_FORWARD) {
+            _uring_recv(state, s);
+            return;
         }
     }
-    return NULL; 
+#endif
+    sp_add(get_thread(s)->pfd, s->fd, s);
 }
 
 static void
 _socket_attach(struct socket_mgr_state* state, struct socket* s, uint32_t actor_handle) {
     enum socket_type st = s->type;
-    int fd = s->fd;
     if(st != ST_PREPARE) {
         return;
     }
     s->actor_handle = actor_handle;
     s->type = ST_FORWARD;
-    sp_add(state->pfd, fd, s);
+    _socket_watch(state, s);
+    s->last_read = get_thread(s)->wheel.now;
+    _timeout_schedule(get_thread(s), s);
 }
 
 static void
 _socket_remove(struct socket_mgr_state* state, struct socket* s) {
+    if(s->type == ST_INVALID) {
+        return;
+    }
+
+    // resolver thread may set the fd of a resolving socket
+    spinlock_lock(&s->lock);
     enum socket_type st = s->type;
     int fd = s->fd;
     if(st == ST_INVALID) {
+        spinlock_unlock(&s->lock);
         return;
     }
-
-    spinlock_lock(&s->lock);
-    if(st != ST_PREPARE) {
-        sp_del(state->pfd, fd);
+    if(st != ST_PREPARE && st != ST_RESOLVING) {
+        sp_del(get_thread(s)->pfd, fd);
     }
+    _timeout_unlink(get_thread(s), s);
 
     // printf("socket remove s:%p st:%d id:%d fd:%d\n", s, st, s->id, s->fd);
-    int ret = close(fd);
+    int ret = (fd >= 0)?(close(fd)):(0);
     assert(ret == 0);
     _buffer_free(s);
+    _relay_free(s);
     s->id = -1;
     s->actor_handle = SYS_HANDLE;
+    s->attach_handle = SYS_HANDLE;
+    s->send_pending = 0;
+    s->listen_id = -1;
+    s->listen_next = -1;
+    s->accept_retry = 0;
     s->fd = -1;
     s->type = ST_INVALID;
     spinlock_unlock(&s->lock);
+
+#ifdef SP_IO_URING
+    // the slot is freed by the last completion
+    if(s->uring_ops > 0) {
+        return;
+    }
+#endif
+    spinlock_lock(&state->slot_lock);
+    _slot_push_free(state, s);
+    spinlock_unlock(&state->slot_lock);
 }
 
 static inline void
-_insert_close_socket(struct socket_mgr_state* state, struct socket* s) {
-    size_t size = state->prepare_close_sockets.size;
-    size_t idx = state->prepare_close_sockets.idx;
-    struct socket** slots = state->prepare_close_sockets.slots;
+_insert_close_socket(struct socket_thread* t, struct socket* s) {
+    size_t size = t->prepare_close_sockets.size;
+    size_t idx = t->prepare_close_sockets.idx;
+    struct socket** slots = t->prepare_close_sockets.slots;
     if(idx >= size) {
         size *= 2;
-        slots = hive_realloc(slots, size);
-        state->prepare_close_sockets.slots = slots;
-        state->prepare_close_sockets.size = size;
+        slots = hive_realloc(slots, sizeof(struct socket*)*size);
+        t->prepare_close_sockets.slots = slots;
+        t->prepare_close_sockets.size = size;
     }
-    slots[state->prepare_close_sockets.idx++] = s;
+    slots[t->prepare_close_sockets.idx++] = s;
 }
 
 static inline void
-_clear_close_socket(struct socket_mgr_state* state) {
-    state->prepare_close_sockets.idx = 0;
+_clear_close_socket(struct socket_thread* t) {
+    t->prepare_close_sockets.idx = 0;
 }
 
+// gather the iov fragments into a new block, skip the first offset bytes
 static inline struct buffer_block*
-_buffer_new_block(const void* data, size_t size) {
+_buffer_new_block(const struct iovec* iov, int count, size_t offset, size_t size) {
     struct buffer_block* block = (struct buffer_block*)hive_malloc(sizeof(struct buffer_block) + size);
     block->next = NULL;
     block->sz = size;
     block->offset = 0;
-    memcpy(block->buffer, data, size);
+    uint8_t* dst = block->buffer;
+    int i;
+    for(i=0; i<count; i++) {
+        size_t len = iov[i].iov_len;
+        if(offset >= len) {
+            offset -= len;
+            continue;
+        }
+        memcpy(dst, (uint8_t*)iov[i].iov_base + offset, len - offset);
+        dst += len - offset;
+        offset = 0;
+    }
     return block;
 }
 
@@ -300,32 +878,89 @@ _buffer_new_block(const void* data, size_t size) {
 static inline void
 _buffer_append(struct socket* s, struct buffer_block* block) {
     if(s->write_buffer.tail == NULL) {
-        s->write_buffer.tail = block;
+        s->write_buffer.head = block;
     }else {
         s->write_buffer.tail->next = block;
     }
-
-    if(s->write_buffer.head == NULL) {
-        s->write_buffer.head = block;
-    }
+    s->write_buffer.tail = block;
 }
 
 static void
 _buffer_free(struct socket* s) {
     struct buffer_block* p = s->write_buffer.head;
+    s->write_buffer.tail = NULL;
+    s->write_buffer.head = NULL;
+#ifdef SP_IO_URING
+    // the blocks in send chain are freed by their completions
+    if(p && s->uring_sending > 0) {
+        struct buffer_block* last = p;
+        int i;
+        for(i=1; i<s->uring_sending && last->next; i++) {
+            last = last->next;
+        }
+        s->write_buffer.head = p;
+        s->write_buffer.tail = last;
+        p = last->next;
+        last->next = NULL;
+    }
+#endif
     while(p) {
         struct buffer_block* next = p->next;
         hive_free(p);
         p = next;
     }
-    s->write_buffer.tail = NULL;
-    s->write_buffer.head = NULL;
 }
 
 
 
+// the failed option is logged only, the socket works with system default
+static void
+_socket_setopt(int fd, const struct socket_opt* opt) {
+    char buffer[MAX_ERROR_STRING];
+    int on = 1;
+    if(opt->nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void*)&on, sizeof(on)) == -1) {
+        sm_log("set TCP_NODELAY of fd:%d is error: %s", fd, _socket_strerror(errno, buffer, sizeof(buffer)));
+    }
+    if(opt->keepalive && setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, (void*)&on, sizeof(on)) == -1) {
+        sm_log("set SO_KEEPALIVE of fd:%d is error: %s", fd, _socket_strerror(errno, buffer, sizeof(buffer)));
+    }
+    if(opt->sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (void*)&opt->sndbuf, sizeof(opt->sndbuf)) == -1) {
+        sm_log("set SO_SNDBUF of fd:%d is error: %s", fd, _socket_strerror(errno, buffer, sizeof(buffer)));
+    }
+    if(opt->rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (void*)&opt->rcvbuf, sizeof(opt->rcvbuf)) == -1) {
+        sm_log("set SO_RCVBUF of fd:%d is error: %s", fd, _socket_strerror(errno, buffer, sizeof(buffer)));
+    }
+}
+
+
+// bind and listen the fd, return the listener id. fd is not closed at error
+static int
+_socket_bind_listen(struct socket_mgr_state* state, int fd, const struct sockaddr* addr, socklen_t addr_len, int thread, const struct socket_opt* opt) {
+    // receive buffer must be set before listen to take effect on window scale
+    _socket_setopt(fd, opt);
+
+    if(bind(fd, addr, addr_len) != 0) {
+        return -4;
+    }
+
+    sp_nonblocking(fd);
+    if(listen(fd, (opt->backlog > 0)?(opt->backlog):(DEFAULT_BACKLOG)) == -1) {
+        return -6;
+    }
+
+    struct socket* s = _socket_gen(state, thread);
+    if(!s) {
+        return -5;
+    }
+
+    s->type = ST_LISTEN;
+    s->fd = fd;
+    return s->id;
+}
+
+
 static int
-_socket_listen(struct socket_mgr_state* state, const char* host, uint16_t port) {
+_socket_listen(struct socket_mgr_state* state, const char* host, uint16_t port, int thread, const struct socket_opt* opt) {
     int fd = -1;
     int reuse = 1;
     int ret = -2;
@@ -353,29 +988,21 @@ _socket_listen(struct socket_mgr_state* state, const char* host, uint16_t port)
         goto LISTEN_ERROR;
     }
 
-    status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
-    if(status != 0) {
-        ret = -4;
+#ifdef SO_REUSEPORT
+    // every socket thread listen the same port, the kernel balance the connections
+    if(state->thread_count > 1 &&
+       setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void*)&reuse, sizeof(reuse)) == -1) {
+        ret = -3;
         goto LISTEN_ERROR;
     }
+#endif
 
-    struct socket* s = _socket_gen(state);
-    if(!s) {
-        ret = -5;
-        goto LISTEN_ERROR;    
-    }
-
-    sp_nonblocking(fd);
-    if(listen(fd, 128) == -1) {
-        ret = -6;
+    ret = _socket_bind_listen(state, fd, ai_list->ai_addr, ai_list->ai_addrlen, thread, opt);
+    if(ret < 0) {
         goto LISTEN_ERROR;
     }
-
-    s->type = ST_LISTEN;
-    // printf("set_socket s:%p id:%d old_fd:%d new_fd:%d\n", s, s->id, s->fd, fd);
-    s->fd = fd;
     freeaddrinfo(ai_list);
-    return s->id;
+    return ret;
 
 LISTEN_ERROR:
     freeaddrinfo(ai_list);
@@ -386,59 +1013,233 @@ LISTEN_ERROR:
 }
 
 
-static void
-_request_send(struct socket_mgr_state* state, struct request_package* msg) {
-    for(;;) {
-        ssize_t n = write(state->sendctrl_fd, msg, PKG_SIZE);
-        if(n < 0) {
-            if (errno != EINTR) {
-                sm_log("[hive] request send error: %s.\n", strerror(errno));
-                break;
-            }
-            continue;
-        }
-        assert(n == PKG_SIZE);
-        return;
+// a leading '@' is the abstract name of linux, it has no file
+static bool
+_unix_addr(const char* path, struct dns_addr* out) {
+    struct sockaddr_un* addr = (struct sockaddr_un*)&out->addr;
+    size_t len = strlen(path);
+    if(len == 0 || len >= sizeof(addr->sun_path)) {
+        return false;
     }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, len);
+    out->family = AF_UNIX;
+    out->len = offsetof(struct sockaddr_un, sun_path) + len + 1;
+#ifdef __linux__
+    if(path[0] == '@') {
+        addr->sun_path[0] = '\0';
+        out->len = offsetof(struct sockaddr_un, sun_path) + len;
+    }
+#endif
+    return true;
 }
 
 
+// the tcp options are not for unix socket
 static void
-_request_listen(struct socket_mgr_state* state, int id) {
-    struct request_package msg;
-    msg.type = REQ_LISTEN;
-    msg.socket_id = id;
-    _request_send(state, &msg);
+_unix_opt(const struct socket_opt* opt, struct socket_opt* out) {
+    memset(out, 0, sizeof(*out));
+    if(opt) {
+        *out = *opt;
+    }
+    out->nodelay = 0;
+    out->keepalive = 0;
 }
 
 
-static void
-_request_connect(struct socket_mgr_state* state, int id) {
-    struct request_package msg;
-    msg.type = REQ_CONNECT;
-    msg.socket_id = id;
-    _request_send(state, &msg);
+// the socket file left by a dead process refuse the connection, it can be removed
+static bool
+_unix_stale(const struct dns_addr* addr) {
+    const struct sockaddr_un* un = (const struct sockaddr_un*)&addr->addr;
+    struct stat st;
+    if(un->sun_path[0] == '\0' || lstat(un->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return false;
+    }
+    sp_nonblocking(fd);
+    bool stale = connect(fd, (const struct sockaddr*)&addr->addr, addr->len) != 0 && errno == ECONNREFUSED;
+    close(fd);
+    return stale && unlink(un->sun_path) == 0;
 }
 
-static void
-_request_close(struct socket_mgr_state* state, int id) {
-    struct request_package msg;
-    msg.type = REQ_CLOSE;
-    msg.socket_id = id;
-    _request_send(state, &msg);
-}
 
-static void
-_request_attach(struct socket_mgr_state* state, int id, uint32_t actor_handle) {
-    struct request_package msg;
-    msg.type = REQ_ATTACH;
-    msg.socket_id = id;
-    msg.v.attach_handle = actor_handle;
-    _request_send(state, &msg);
+static int
+_socket_listen_unix(struct socket_mgr_state* state, const char* path, const struct socket_opt* opt) {
+    struct dns_addr addr;
+    if(!_unix_addr(path, &addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -2;
+    }
+    int ret = _socket_bind_listen(state, fd, (struct sockaddr*)&addr.addr, addr.len, 0, opt);
+    if(ret == -4 && errno == EADDRINUSE && _unix_stale(&addr)) {
+        ret = _socket_bind_listen(state, fd, (struct sockaddr*)&addr.addr, addr.len, 0, opt);
+    }
+    if(ret < 0) {
+        close(fd);
+    }
+    return ret;
 }
 
+
 static void
-_request_msgsend(struct socket_mgr_state* state, int id, struct buffer_block* block) {
+_doorbell_ring(struct socket_thread* t) {
+#ifdef __linux__
+    uint64_t v = 1;
+#else
+    uint8_t v = 1;
+#endif
+    for(;;) {
+        ssize_t n = write(t->sendctrl_fd, &v, sizeof(v));
+        if(n < 0) {
+            int err = errno;
+            if(err == EINTR) {
+                continue;
+            }else if(err != EAGAIN) {
+                char buffer[MAX_ERROR_STRING];
+                sm_log("[hive] request doorbell error: %s.\n", _socket_strerror(err, buffer, sizeof(buffer)));
+            }
+        }
+        return;
+    }
+}
+
+static void
+_doorbell_clear(struct socket_thread* t) {
+    uint8_t buf[64];
+    for(;;) {
+        ssize_t n = read(t->recvctrl_fd, buf, sizeof(buf));
+        if(n < 0) {
+            int err = errno;
+            if(err == EINTR) {
+                continue;
+            }else if(err != EAGAIN) {
+                hive_panic("socket request doorbell read a error:%d", err);
+            }
+            return;
+        }else if(n == 0) {
+            hive_panic("socket request doorbell is closed");
+        }
+    }
+}
+
+// push to the lock free stack, return the old head
+static inline struct request_package*
+_request_push(struct socket_thread* t, struct request_package* req) {
+    struct request_package* head;
+    do {
+        head = t->request_head;
+        req->next = head;
+    } while(!ATOM_CAS_POINTER(&t->request_head, head, req));
+    return head;
+}
+
+// only ring the doorbell when the queue was empty
+static void
+_request_push_thread(struct socket_thread* t, struct request_package* msg) {
+    struct request_package* req = (struct request_package*)hive_malloc(PKG_SIZE);
+    *req = *msg;
+    if(_request_push(t, req) == NULL) {
+        _doorbell_ring(t);
+    }
+}
+
+// the request is run by the thread which own the socket
+static void
+_request_send(struct socket_mgr_state* state, struct request_package* msg) {
+    struct socket* s = get_socket(msg->socket_id);
+    _request_push_thread(get_thread(s), msg);
+}
+
+
+static void
+_request_listen(struct socket_mgr_state* state, int id) {
+    struct request_package msg;
+    msg.type = REQ_LISTEN;
+    msg.socket_id = id;
+    _request_send(state, &msg);
+}
+
+
+static void
+_request_connect(struct socket_mgr_state* state, int id) {
+    struct request_package msg;
+    msg.type = REQ_CONNECT;
+    msg.socket_id = id;
+    _request_send(state, &msg);
+}
+
+static void
+_request_close(struct socket_mgr_state* state, int id) {
+    struct request_package msg;
+    msg.type = REQ_CLOSE;
+    msg.socket_id = id;
+    _request_send(state, &msg);
+}
+
+static void
+_request_attach(struct socket_mgr_state* state, int id, uint32_t actor_handle) {
+    struct request_package msg;
+    msg.type = REQ_ATTACH;
+    msg.socket_id = id;
+    msg.v.attach_handle = actor_handle;
+    _request_send(state, &msg);
+}
+
+static void
+_request_resume(struct socket_mgr_state* state, int id) {
+    struct request_package msg;
+    msg.type = REQ_RESUME;
+    msg.socket_id = id;
+    _request_send(state, &msg);
+}
+
+static void
+_request_timeout(struct socket_mgr_state* state, int id, int connect, int read, int write) {
+    struct request_package msg;
+    msg.type = REQ_TIMEOUT;
+    msg.socket_id = id;
+    msg.v.timeout.connect = connect;
+    msg.v.timeout.read = read;
+    msg.v.timeout.write = write;
+    _request_send(state, &msg);
+}
+
+static void
+_request_watermark(struct socket_mgr_state* state, int id, size_t high, size_t low) {
+    struct request_package msg;
+    msg.type = REQ_WATERMARK;
+    msg.socket_id = id;
+    msg.v.watermark.high = high;
+    msg.v.watermark.low = low;
+    _request_send(state, &msg);
+}
+
+static void
+_request_relay(struct socket_mgr_state* state, int id, int relay_id) {
+    struct request_package msg;
+    msg.type = REQ_RELAY;
+    msg.socket_id = id;
+    msg.v.relay_id = relay_id;
+    _request_send(state, &msg);
+}
+
+static void
+_request_relay_start(struct socket_mgr_state* state, int id) {
+    struct request_package msg;
+    msg.type = REQ_RELAY_START;
+    msg.socket_id = id;
+    _request_send(state, &msg);
+}
+
+static void
+_request_msgsend(struct socket_mgr_state* state, int id, struct buffer_block* block) {
     struct request_package msg;
     msg.type = REQ_SEND;
     msg.socket_id = id;
@@ -448,86 +1249,264 @@ _request_msgsend(struct socket_mgr_state* state, int id, struct buffer_block* bl
 
 
 int
-socket_mgr_listen(struct socket_mgr_state* state, const char* host, uint16_t port, uint32_t actor_handle) {
-    int id = _socket_listen(state, host, port);
-    if(id >= 0) {
-        struct socket* s = get_socket(id);
-        assert(s->type == ST_LISTEN);
-        s->actor_handle = actor_handle;
-        sp_nonblocking(s->fd);
-        _request_listen(state, s->id);
+socket_mgr_listen(struct socket_mgr_state* state, const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt) {
+    struct socket_opt default_opt;
+    if(opt == NULL) {
+        memset(&default_opt, 0, sizeof(default_opt));
+        opt = &default_opt;
+    }
+    uint32_t attach_handle = opt->attach_handle;
+    int id = _socket_listen(state, host, port, 0, opt);
+    if(id < 0) {
+        return id;
+    }
+
+    struct socket* s = get_socket(id);
+    assert(s->type == ST_LISTEN);
+    s->actor_handle = actor_handle;
+    s->attach_handle = attach_handle;
+    sp_nonblocking(s->fd);
+
+#ifdef SO_REUSEPORT
+    // the other threads listen the same port, their accept report the first listener id.
+    // the listeners are chained by listen_next, close the first one close all of them.
+    if(state->thread_count > 1) {
+        struct socket_addrinfo addrinfo;
+        const char* err = NULL;
+        if(port == 0 && _socket_getaddr(state, s, &addrinfo, &err) == 0) {
+            port = addrinfo.port;
+        }
+
+        int i;
+        for(i=1; i<state->thread_count; i++) {
+            int sid = _socket_listen(state, host, port, i, opt);
+            if(sid < 0) {
+                sm_log("listen %s:%d at socket thread %d is error: %d", host, port, i, sid);
+                break;
+            }
+            struct socket* ss = get_socket(sid);
+            ss->actor_handle = actor_handle;
+            ss->attach_handle = attach_handle;
+            ss->listen_id = id;
+            ss->listen_next = s->listen_next;
+            s->listen_next = sid;
+            _request_listen(state, sid);
+        }
     }
+#endif
+
+    _request_listen(state, s->id);
     return id;
 }
 
 
-static int
-_socket_connect(struct socket_mgr_state* state, const char* host, uint16_t port, char const** out_err) {
-    struct addrinfo ai_hints = {0};
-    struct addrinfo* ai_list = NULL;
-    char portstr[16];
-    sprintf(portstr, "%d", port);
-    ai_hints.ai_protocol = IPPROTO_TCP;
-    ai_hints.ai_family = AF_UNSPEC;
-    ai_hints.ai_socktype = SOCK_STREAM;
+// every socket thread poll a dup of the listen fd, so the connections are spread like tcp.
+// the stale socket file of path is removed, but it is not removed when the listener is closed.
+int
+socket_mgr_listen_unix(struct socket_mgr_state* state, const char* path, uint32_t actor_handle, const struct socket_opt* opt) {
+    struct socket_opt unix_opt;
+    _unix_opt(opt, &unix_opt);
+    int id = _socket_listen_unix(state, path, &unix_opt);
+    if(id < 0) {
+        return id;
+    }
 
-    *out_err = NULL;
-    int status = getaddrinfo(host, portstr, &ai_hints, &ai_list);
-    if(status != 0) {
-        *out_err = gai_strerror(status);
-        return -1;
+    struct socket* s = get_socket(id);
+    assert(s->type == ST_LISTEN);
+    s->actor_handle = actor_handle;
+    s->attach_handle = unix_opt.attach_handle;
+
+    int i;
+    for(i=1; i<state->thread_count; i++) {
+        int fd = dup(s->fd);
+        struct socket* ss = (fd >= 0)?(_socket_gen(state, i)):(NULL);
+        if(ss == NULL) {
+            char buffer[MAX_ERROR_STRING];
+            sm_log("listen %s at socket thread %d is error: %s", path, i, (fd < 0)?(_socket_strerror(errno, buffer, sizeof(buffer))):("socket slot is full"));
+            if(fd >= 0) {
+                close(fd);
+            }
+            break;
+        }
+        ss->fd = fd;
+        ss->type = ST_LISTEN;
+        ss->actor_handle = actor_handle;
+        ss->attach_handle = unix_opt.attach_handle;
+        ss->listen_id = id;
+        ss->listen_next = s->listen_next;
+        s->listen_next = ss->id;
+        _request_listen(state, ss->id);
     }
 
+    _request_listen(state, s->id);
+    return id;
+}
+
+
+// open a nonblocking socket connecting to the first reachable address
+static int
+_socket_open(const struct dns_addr* addrs, int count, const struct socket_opt* opt, bool* out_connected, char const** out_err) {
     int fd = -1;
-    struct addrinfo *ai_ptr = NULL;
-    for(ai_ptr=ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next) {
-        fd = socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+    int i;
+    for(i=0; i<count; i++) {
+        fd = socket(addrs[i].family, SOCK_STREAM, 0);
         if(fd < 0) {
             continue;
         }
         sp_nonblocking(fd);
-        status = connect(fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        _socket_setopt(fd, opt);
+        int status = connect(fd, (struct sockaddr*)&addrs[i].addr, addrs[i].len);
         if(status != 0 && errno != EINPROGRESS) {
             close(fd);
             fd = -1;
         } else {
+            *out_connected = (status == 0);
             break;
         }
     }
 
-    int ret = 0;
     if(fd < 0) {
-        *out_err = strerror(errno);
-        ret = -2;
-        goto CONNECT_ERROR;
+        *out_err = _socket_strerror(errno, ERROR_BUFFER, sizeof(ERROR_BUFFER));
+    }
+    return fd;
+}
+
+
+static int
+_socket_connect(struct socket_mgr_state* state, const struct dns_addr* addrs, int n, const struct socket_opt* opt, char const** out_err) {
+    bool connected = false;
+    int fd = _socket_open(addrs, n, opt, &connected, out_err);
+    if(fd < 0) {
+        return -2;
     }
 
-    struct socket* s = _socket_gen(state);
+    int thread = (int)((unsigned)ATOM_FINC(&state->thread_index) % (unsigned)state->thread_count);
+    struct socket* s = _socket_gen(state, thread);
     if(!s) {
-        ret = -3;
-        goto CONNECT_ERROR;
+        *out_err = "socket slot is full";
+        close(fd);
+        return -3;
     }
 
     s->fd = fd;
-    s->type = (status==0)?(ST_CONNECTED):(ST_CONNECTING);
-    freeaddrinfo(ai_list);
+    s->type = (connected)?(ST_CONNECTED):(ST_CONNECTING);
     return s->id;
+}
 
-CONNECT_ERROR:
-    if(fd>0) {
-        close(fd);
+
+// host name is resolved by resolver thread, the result is reported by SE_CONNECTED
+static int
+_socket_connect_async(struct socket_mgr_state* state, const char* host, uint16_t port, const struct socket_opt* opt, char const** out_err, uint32_t actor_handle) {
+    *out_err = NULL;
+    int thread = (int)((unsigned)ATOM_FINC(&state->thread_index) % (unsigned)state->thread_count);
+    struct socket* s = _socket_gen(state, thread);
+    if(!s) {
+        *out_err = "socket slot is full";
+        return -3;
+    }
+    s->actor_handle = actor_handle;
+    s->type = ST_RESOLVING;
+
+    size_t len = strlen(host);
+    struct resolve_job* job = (struct resolve_job*)hive_malloc(sizeof(struct resolve_job) + len + 1);
+    job->next = NULL;
+    job->id = s->id;
+    job->port = port;
+    job->opt = *opt;
+    memcpy(job->host, host, len + 1);
+
+    pthread_mutex_lock(&state->resolver.lock);
+    if(state->resolver.tail) {
+        state->resolver.tail->next = job;
+    }else {
+        state->resolver.head = job;
     }
+    state->resolver.tail = job;
+    pthread_cond_signal(&state->resolver.cond);
+    pthread_mutex_unlock(&state->resolver.lock);
+    return s->id;
+}
 
-    if(ai_list) {
-        freeaddrinfo(ai_list);
+
+static void
+_socket_resolve(struct socket_mgr_state* state, struct resolve_job* job) {
+    struct dns_addr addrs[MAX_DNS_ADDR];
+    const char* err = NULL;
+    bool connected = false;
+    int fd = -1;
+    int n = dns_resolve(state->resolver.cache, job->host, job->port, addrs, MAX_DNS_ADDR, &err);
+    if(n > 0) {
+        fd = _socket_open(addrs, n, &job->opt, &connected, &err);
     }
-    return ret;
+
+    int id = job->id;
+    struct socket* s = get_socket(id);
+    spinlock_lock(&s->lock);
+    // closed when resolving
+    if(s->id != id || s->type != ST_RESOLVING) {
+        spinlock_unlock(&s->lock);
+        if(fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    if(fd >= 0) {
+        s->fd = fd;
+        s->type = (connected)?(ST_CONNECTED):(ST_CONNECTING);
+        spinlock_unlock(&s->lock);
+        _request_connect(state, id);
+    }else {
+        // notify in lock, then socket thread remove it
+        _actor_notify_connected(s, err);
+        s->type = ST_PREPARE;
+        spinlock_unlock(&s->lock);
+        _request_close(state, id);
+    }
+}
+
+
+int
+socket_mgr_resolve(struct socket_mgr_state* state) {
+    pthread_mutex_lock(&state->resolver.lock);
+    while(state->resolver.head == NULL && !state->resolver.exit) {
+        pthread_cond_wait(&state->resolver.cond, &state->resolver.lock);
+    }
+    if(state->resolver.exit) {
+        pthread_mutex_unlock(&state->resolver.lock);
+        return -1;
+    }
+    struct resolve_job* job = state->resolver.head;
+    state->resolver.head = job->next;
+    if(state->resolver.head == NULL) {
+        state->resolver.tail = NULL;
+    }
+    pthread_mutex_unlock(&state->resolver.lock);
+
+    _socket_resolve(state, job);
+    hive_free(job);
+    return 0;
 }
 
 
 int
-socket_mgr_connect(struct socket_mgr_state* state, const char* host, uint16_t port, char const** out_err, uint32_t actor_handle) {
-    int id = _socket_connect(state, host, port, out_err);
+socket_mgr_connect(struct socket_mgr_state* state, const char* host, uint16_t port, char const** out_err, uint32_t actor_handle, const struct socket_opt* opt) {
+    struct socket_opt default_opt;
+    if(opt == NULL) {
+        memset(&default_opt, 0, sizeof(default_opt));
+        opt = &default_opt;
+    }
+    if(!dns_is_numeric(host)) {
+        return _socket_connect_async(state, host, port, opt, out_err, actor_handle);
+    }
+
+    struct dns_addr addrs[MAX_DNS_ADDR];
+    *out_err = NULL;
+    int n = dns_resolve(state->resolver.cache, host, port, addrs, MAX_DNS_ADDR, out_err);
+    if(n < 0) {
+        return -1;
+    }
+
+    int id = _socket_connect(state, addrs, n, opt, out_err);
     if(id >= 0 ) {
         struct socket* s = get_socket(id);
         assert(s->type == ST_CONNECTING || s->type == ST_CONNECTED);
@@ -538,6 +1517,27 @@ socket_mgr_connect(struct socket_mgr_state* state, const char* host, uint16_t po
 }
 
 
+// a unix socket connect at once or fail, the result is still reported by SE_CONNECTED
+int
+socket_mgr_connect_unix(struct socket_mgr_state* state, const char* path, char const** out_err, uint32_t actor_handle, const struct socket_opt* opt) {
+    struct dns_addr addr;
+    struct socket_opt unix_opt;
+    _unix_opt(opt, &unix_opt);
+    *out_err = NULL;
+    if(!_unix_addr(path, &addr)) {
+        *out_err = "invalid unix socket path";
+        return -1;
+    }
+
+    int id = _socket_connect(state, &addr, 1, &unix_opt, out_err);
+    if(id >= 0 ) {
+        struct socket* s = get_socket(id);
+        s->actor_handle = actor_handle;
+        _request_connect(state, id);
+    }
+    return id;
+}
+
 
 int
 socket_mgr_close(struct socket_mgr_state* state, int id) {
@@ -567,12 +1567,54 @@ socket_mgr_attach(struct socket_mgr_state* state, int id, uint32_t actor_handle)
 }
 
 
+int
+socket_mgr_pause(struct socket_mgr_state* state, int id) {
+    if(id < 0) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    enum socket_type st = s->type;
+    if((st != ST_PREPARE && st != ST_FORWARD) || s->id != id) {
+        return -2;
+    }
+    // socket thread read it without the lock, resume clear it by cas
+    ATOM_CAS(&s->paused, 0, 1);
+    return 0;
+}
+
+
+// no more read edge for the data arrived when paused, so socket thread read it at once
+int
+socket_mgr_resume(struct socket_mgr_state* state, int id) {
+    if(id < 0) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    enum socket_type st = s->type;
+    if((st != ST_PREPARE && st != ST_FORWARD) || s->id != id) {
+        return -2;
+    }
+    if(ATOM_CAS(&s->paused, 1, 0) && st == ST_FORWARD) {
+        _request_resume(state, id);
+    }
+    return 0;
+}
+
+
 void
 socket_mgr_exit(struct socket_mgr_state* state) {
+    pthread_mutex_lock(&state->resolver.lock);
+    state->resolver.exit = true;
+    pthread_cond_broadcast(&state->resolver.cond);
+    pthread_mutex_unlock(&state->resolver.lock);
+
     struct request_package msg;
     msg.type = REQ_EXIT;
     msg.socket_id = -1;
-    _request_send(state, &msg);
+    int i;
+    for(i=0; i<state->thread_count; i++) {
+        _request_push_thread(&state->threads[i], &msg);
+    }
 }
 
 
@@ -599,29 +1641,56 @@ socket_mgr_addrinfo(struct socket_mgr_state* state, int id, struct socket_addrin
 
 int
 socket_mgr_send(struct socket_mgr_state* state, int id, const void* data, size_t size) {
-    if(id < 0 || data == NULL || size == 0) {
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = size;
+    return socket_mgr_sendv(state, id, &iov, 1);
+}
+
+
+// fragments are written by one writev or queued as one block,
+// so they are never interleaved with other sends.
+int
+socket_mgr_sendv(struct socket_mgr_state* state, int id, const struct iovec* iov, int count) {
+    if(id < 0 || iov == NULL || count <= 0 || count > MAX_SEND_IOV) {
+        return -1;
+    }
+    size_t size = 0;
+    int i;
+    for(i=0; i<count; i++) {
+        if(iov[i].iov_base == NULL && iov[i].iov_len > 0) {
+            return -1;
+        }
+        size += iov[i].iov_len;
+    }
+    if(size == 0) {
         return -1;
     }
+
     struct socket* s = get_socket(id);
     enum socket_type st = s->type;
-    if((st != ST_FORWARD && st != ST_CONNECTING && st != ST_CONNECTED) || s->id != id) {
+    if((st != ST_FORWARD && st != ST_CONNECTING && st != ST_CONNECTED && st != ST_RESOLVING) || s->id != id) {
         return -2;
     }
 
     ssize_t n = 0;
     if(spinlock_trylock(&s->lock)) {
-        if(s->id != id) {
+        // the relay owns the fd, only the data before relay_start is sent.
+        // the socket thread link and start the relay under the lock, the queued send
+        // is refused by it when the lock is busy.
+        bool relayed = (s->relay_id >= 0);
+        if(s->id != id || (relayed && s->relay_state != RELAY_HOLD)) {
             spinlock_unlock(&s->lock);
             return -2;
         }
 
-        if(write_buffer_empty(s) && st == ST_FORWARD) {
+        // don't jump ahead of the data in the request queue,
+        // the data of relay is ordered with the pipe by socket thread
+        if(write_buffer_empty(s) && s->send_pending == 0 && st == ST_FORWARD && !relayed) {
             int fd = s->fd;
-            n = write(fd, data, size);
+            n = (count == 1)?(write(fd, iov[0].iov_base, size)):(writev(fd, iov, count));
             if(n < 0) {
                 n = 0;
-            }else if(n < size) {
-                n = size - n;
             }else if (n == size) {
                 spinlock_unlock(&s->lock);
                 return 0;
@@ -630,221 +1699,1507 @@ socket_mgr_send(struct socket_mgr_state* state, int id, const void* data, size_t
         spinlock_unlock(&s->lock);
     }
 
+    // queue the unsent rest of all fragments as one block
     assert(n>=0 && ((size_t)n)<size);
-    struct buffer_block* block = _buffer_new_block( (void*)((uint8_t*)data+n), size - (size_t)n);
+    struct buffer_block* block = _buffer_new_block(iov, count, (size_t)n, size - (size_t)n);
+    ATOM_ADD(&s->send_queued, block->sz);
+    ATOM_INC(&s->send_pending);
     _request_msgsend(state, id, block);
     return 0;
 }
 
 
 
-static void
-_socket_do_send(struct socket_mgr_state* state, struct socket* s) {
-    int fd = s->fd;
-    struct buffer_block* p = s->write_buffer.head;
-    size_t offset = 0;
-    while(p) {
-        struct buffer_block* next = p->next;
-        offset = p->offset;
-        void* data = p->buffer + offset;
-        size_t sz = p->sz - offset;
-        int n = write(fd, data, sz);
-        // printf("do_send s:%p id:%d fd:%d size:%zd n:%d\n", s, s->id, s->fd, sz, n);
+// send the datagrams until EAGAIN, return the count consumed.
+// the datagram refused by kernel is dropped as it is lost in network.
+static int
+_udp_sendmsg(int fd, struct msghdr* hdrs, int count) {
+    int sent = 0;
+    while(sent < count) {
+#ifdef __linux__
+        struct mmsghdr msgs[MAX_UDP_SEND];
+        int n = count - sent;
+        int i;
+        if(n > MAX_UDP_SEND) {
+            n = MAX_UDP_SEND;
+        }
+        for(i=0; i<n; i++) {
+            msgs[i].msg_hdr = hdrs[sent+i];
+            msgs[i].msg_len = 0;
+        }
+        int ret = sendmmsg(fd, msgs, n, 0);
+#else
+        int ret = (sendmsg(fd, &hdrs[sent], 0) < 0)?(-1):(1);
+#endif
+        if(ret < 0) {
+            int err = errno;
+            if(err == EINTR) {
+                continue;
+            }else if(err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) {
+                break;
+            }
+            ret = 1;
+        }
+        sent += ret;
+    }
+    return sent;
+}
+
+
+static void
+_udp_msghdr(struct msghdr* hdr, const void* addr, socklen_t addr_len, struct iovec* iov) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->msg_name = (void*)addr;
+    hdr->msg_namelen = addr_len;
+    hdr->msg_iov = iov;
+    hdr->msg_iovlen = 1;
+}
+
+
+int
+socket_mgr_udp(struct socket_mgr_state* state, const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt, char const** out_err) {
+    struct addrinfo ai_hints = {0};
+    struct addrinfo* ai_list = NULL;
+    char portstr[16];
+    sprintf(portstr, "%d", port);
+    ai_hints.ai_protocol = IPPROTO_UDP;
+    ai_hints.ai_family = AF_UNSPEC;
+    ai_hints.ai_socktype = SOCK_DGRAM;
+    ai_hints.ai_flags = AI_PASSIVE;
+    *out_err = NULL;
+
+    int status = getaddrinfo(host, portstr, &ai_hints, &ai_list);
+    if(status != 0) {
+        *out_err = gai_strerror(status);
+        return -1;
+    }
+
+    int fd = socket(ai_list->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd < 0) {
+        *out_err = _socket_strerror(errno, ERROR_BUFFER, sizeof(ERROR_BUFFER));
+        freeaddrinfo(ai_list);
+        return -2;
+    }
+    // tcp options are not for datagram
+    if(opt) {
+        struct socket_opt udp_opt = {0};
+        udp_opt.sndbuf = opt->sndbuf;
+        udp_opt.rcvbuf = opt->rcvbuf;
+        _socket_setopt(fd, &udp_opt);
+    }
+    status = bind(fd, ai_list->ai_addr, ai_list->ai_addrlen);
+    freeaddrinfo(ai_list);
+    if(status != 0) {
+        *out_err = _socket_strerror(errno, ERROR_BUFFER, sizeof(ERROR_BUFFER));
+        close(fd);
+        return -3;
+    }
+    sp_nonblocking(fd);
+
+    int thread = (int)((unsigned)ATOM_FINC(&state->thread_index) % (unsigned)state->thread_count);
+    struct socket* s = _socket_gen(state, thread);
+    if(!s) {
+        *out_err = "socket slot is full";
+        close(fd);
+        return -4;
+    }
+    s->fd = fd;
+    s->actor_handle = actor_handle;
+    s->type = ST_UDP;
+    _request_listen(state, s->id);
+    return s->id;
+}
+
+
+// every iov is a datagram to addr, sent by one sendmmsg when the socket is writable
+int
+socket_mgr_sendto(struct socket_mgr_state* state, int id, const void* addr, size_t addr_len, const struct iovec* iov, int count) {
+    if(id < 0 || addr == NULL || addr_len < sizeof(sa_family_t) || addr_len > sizeof(struct sockaddr_storage) ||
+       iov == NULL || count <= 0 || count > MAX_UDP_SEND) {
+        return -1;
+    }
+    int i;
+    for(i=0; i<count; i++) {
+        if((iov[i].iov_base == NULL && iov[i].iov_len > 0) || iov[i].iov_len >= MAX_UDP_PACKET) {
+            return -1;
+        }
+    }
+
+    struct socket* s = get_socket(id);
+    if(s->type != ST_UDP || s->id != id) {
+        return -2;
+    }
+
+    int sent = 0;
+    if(spinlock_trylock(&s->lock)) {
+        if(s->id != id) {
+            spinlock_unlock(&s->lock);
+            return -2;
+        }
+        // don't jump ahead of the queued datagrams
+        if(write_buffer_empty(s) && s->send_pending == 0) {
+            struct msghdr hdrs[MAX_UDP_SEND];
+            struct iovec msg_iov[MAX_UDP_SEND];
+            for(i=0; i<count; i++) {
+                msg_iov[i] = iov[i];
+                _udp_msghdr(&hdrs[i], addr, (socklen_t)addr_len, &msg_iov[i]);
+            }
+            sent = _udp_sendmsg(s->fd, hdrs, count);
+        }
+        spinlock_unlock(&s->lock);
+    }
+
+    // queue the rest datagrams one block each
+    for(i=sent; i<count; i++) {
+        size_t size = iov[i].iov_len;
+        struct buffer_block* block = (struct buffer_block*)hive_malloc(sizeof(struct buffer_block) + sizeof(struct udp_head) + size);
+        struct udp_head* head = (struct udp_head*)block->buffer;
+        head->addr_len = (socklen_t)addr_len;
+        memcpy(&head->addr, addr, addr_len);
+        block->next = NULL;
+        block->offset = sizeof(struct udp_head);
+        block->sz = block->offset + size;
+        memcpy(block->buffer + block->offset, iov[i].iov_base, size);
+        ATOM_ADD(&s->send_queued, size);
+        ATOM_INC(&s->send_pending);
+        _request_msgsend(state, id, block);
+    }
+    return 0;
+}
+
+
+// the watermarks are applied by socket thread, high 0 is disable
+int
+socket_mgr_watermark(struct socket_mgr_state* state, int id, size_t high, size_t low) {
+    if(id < 0 || low > high) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    if(s->type == ST_INVALID || s->id != id) {
+        return -2;
+    }
+    _request_watermark(state, id, high, low);
+    return 0;
+}
+
+
+// the timeouts are applied by socket thread, 0 is disable
+int
+socket_mgr_timeout(struct socket_mgr_state* state, int id, int connect_ms, int read_ms, int write_ms) {
+    if(id < 0 || connect_ms < 0 || read_ms < 0 || write_ms < 0) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    if(s->type == ST_INVALID || s->id != id) {
+        return -2;
+    }
+    _request_timeout(state, id, connect_ms, read_ms, write_ms);
+    return 0;
+}
+
+
+int
+socket_mgr_relay(struct socket_mgr_state* state, int id, int peer_id) {
+    if(id < 0 || peer_id < 0 || id == peer_id) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    struct socket* p = get_socket(peer_id);
+    if(s->type != ST_FORWARD || s->id != id || p->type != ST_FORWARD || p->id != peer_id) {
+        return -2;
+    }
+    _request_relay(state, id, peer_id);
+    return 0;
+}
+
+
+int
+socket_mgr_relay_start(struct socket_mgr_state* state, int id) {
+    if(id < 0) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    if(s->type != ST_FORWARD || s->id != id) {
+        return -2;
+    }
+    _request_relay_start(state, id);
+    return 0;
+}
+
+
+int64_t
+socket_mgr_queued(struct socket_mgr_state* state, int id) {
+    if(id < 0) {
+        return -1;
+    }
+    struct socket* s = get_socket(id);
+    if(s->type == ST_INVALID || s->id != id) {
+        return -1;
+    }
+    return (int64_t)s->send_queued;
+}
+
+
+// gather the write buffer chain into one writev until EAGAIN,
+// the rest is sent at next edge of write event.
+// must hold the socket lock.
+static void
+_socket_do_send(struct socket_mgr_state* state, struct socket* s) {
+#ifdef SP_IO_URING
+    if(sp_completion(get_thread(s)->pfd)) {
+        _uring_send(state, s);
+        return;
+    }
+#endif
+    int fd = s->fd;
+    struct buffer_block* p = s->write_buffer.head;
+    struct iovec iov[MAX_SEND_IOV];
+    while(p) {
+        int count = 0;
+        size_t sz = 0;
+        struct buffer_block* b;
+        for(b=p; b && count<MAX_SEND_IOV; b=b->next, count++) {
+            iov[count].iov_base = b->buffer + b->offset;
+            iov[count].iov_len = b->sz - b->offset;
+            sz += iov[count].iov_len;
+        }
+
+        ssize_t n = writev(fd, iov, count);
         if(n<0) {
+            if(errno == EINTR) {
+                continue;
+            }
             break;
-        }else if(n<sz) {
-            offset = (sz-n) + offset;
+        }
+
+        // free the blocks that are written
+        ATOM_SUB(&s->send_queued, (size_t)n);
+        if(n > 0) {
+            s->last_write = get_thread(s)->wheel.now;
+        }
+        size_t left = (size_t)n;
+        while(p && left >= p->sz - p->offset) {
+            struct buffer_block* next = p->next;
+            left -= p->sz - p->offset;
+            hive_free(p);
+            p = next;
+        }
+        if(left > 0) {
+            p->offset += left;
+        }
+
+        // short write means the send buffer of kernel is full
+        if((size_t)n < sz) {
             break;
         }
-        hive_free(p);
-        p = next;
     }
 
-    if(p) {
-        p->offset = offset;
-        sp_write(state->pfd, fd, s, true);
-    }else {
+    if(p == NULL) {
+        s->write_buffer.tail = NULL;
+    }
+    s->write_buffer.head = p;
+}
+
+
+// flush the queued datagrams by batch until EAGAIN, must hold the socket lock.
+static void
+_socket_do_sendto(struct socket_mgr_state* state, struct socket* s) {
+    struct buffer_block* p = s->write_buffer.head;
+    struct msghdr hdrs[MAX_UDP_SEND];
+    struct iovec iov[MAX_UDP_SEND];
+    while(p) {
+        int count = 0;
+        struct buffer_block* b;
+        for(b=p; b && count<MAX_UDP_SEND; b=b->next, count++) {
+            struct udp_head* head = (struct udp_head*)b->buffer;
+            iov[count].iov_base = b->buffer + b->offset;
+            iov[count].iov_len = b->sz - b->offset;
+            _udp_msghdr(&hdrs[count], &head->addr, head->addr_len, &iov[count]);
+        }
+
+        int sent = _udp_sendmsg(s->fd, hdrs, count);
+        int i;
+        for(i=0; i<sent; i++) {
+            struct buffer_block* next = p->next;
+            ATOM_SUB(&s->send_queued, p->sz - p->offset);
+            hive_free(p);
+            p = next;
+        }
+        if(sent < count) {
+            break;
+        }
+    }
+
+    if(p == NULL) {
         s->write_buffer.tail = NULL;
-        sp_write(state->pfd, fd, s, false);
     }
-    s->write_buffer.head = p;
+    s->write_buffer.head = p;
+}
+
+
+// notify actor when queued bytes cross the watermarks, only called by socket thread.
+// the watermarks are set by socket thread too, so the pair is read as one.
+static void
+_socket_check_watermark(struct socket* s) {
+    size_t high = s->send_high;
+    if(high == 0 && !s->congested) {
+        return;
+    }
+
+    size_t queued = s->send_queued;
+    if(!s->congested && queued >= high) {
+        s->congested = true;
+        _actor_notify_watermark(s, SE_CONGESTED, queued);
+    }else if(s->congested && queued <= s->send_low) {
+        s->congested = false;
+        _actor_notify_watermark(s, SE_WRITABLE, queued);
+    }
+}
+
+
+static int
+_socket_getaddr(struct socket_mgr_state* state, struct socket* s, struct socket_addrinfo* out_addrinfo, const char** out_error) {
+    int fd = s->fd;
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int err = getsockname(fd, (struct sockaddr*)&addr, &len);
+    if(err < 0) {
+        *out_error = _socket_strerror(errno, ERROR_BUFFER, sizeof(ERROR_BUFFER));
+        return 1;
+    }
+
+    // the path of unix socket, the accepted one has no path
+    if(addr.ss_family == AF_UNIX) {
+        const struct sockaddr_un* un = (const struct sockaddr_un*)&addr;
+        size_t n = (len > offsetof(struct sockaddr_un, sun_path))?(len - offsetof(struct sockaddr_un, sun_path)):(0);
+        if(n > 0 && un->sun_path[0] == '\0') {
+            // abstract name is not terminated
+            out_addrinfo->ip[0] = '@';
+            memcpy(out_addrinfo->ip + 1, un->sun_path + 1, n - 1);
+        }else {
+            n = strnlen(un->sun_path, n);
+            memcpy(out_addrinfo->ip, un->sun_path, n);
+        }
+        out_addrinfo->ip[n] = '\0';
+        out_addrinfo->port = 0;
+        return 0;
+    }
+
+    char str_port[NI_MAXSERV];
+    err = getnameinfo((struct sockaddr*)&addr, len, out_addrinfo->ip, sizeof(out_addrinfo->ip), 
+        str_port, sizeof(str_port), NI_NUMERICHOST | NI_NUMERICSERV);
+    if(err != 0) {
+        *out_error = gai_strerror(err);
+        return 1;
+    }
+    
+    out_addrinfo->port = atoi(str_port);
+    return 0;
+}
+
+
+
+
+static inline int
+_socket_accept(int fd) {
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+    return accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int client_fd = accept(fd, NULL, NULL);
+    if(client_fd >= 0) {
+        sp_nonblocking(client_fd);
+    }
+    return client_fd;
+#endif
+}
+
+
+// when fd is exhausted, give up the reserved fd to accept one and close it at once.
+// the client is reset instead of waiting in backlog. errno is kept when accept is failed.
+static int
+_socket_drop_accept(struct socket_thread* t, int fd) {
+    int err = errno;
+    if(t->reserve_fd < 0) {
+        t->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if(t->reserve_fd < 0) {
+            errno = err;
+            return -1;
+        }
+    }
+    close(t->reserve_fd);
+    int client_fd = _socket_accept(fd);
+    err = errno;
+    if(client_fd >= 0) {
+        close(client_fd);
+    }
+    t->reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    errno = err;
+    return client_fd;
+}
+
+
+// gen the socket of an accepted fd, the ids are reported when the batch is full.
+// the listener with attach_handle attach them at once, so the actor need not attach.
+// return the count of ids not reported
+static int
+_socket_accepted(struct socket_mgr_state* state, struct socket* s, int client_fd, int* ids, int count) {
+    struct socket* cs = _socket_gen(state, s->thread);
+    if(cs == NULL) {
+        sm_log("socket id poll is full.");
+        close(client_fd);
+        return count;
+    }
+
+    cs->fd = client_fd;
+    cs->actor_handle = SYS_HANDLE;
+    if(s->attach_handle != SYS_HANDLE) {
+        _socket_attach(state, cs, s->attach_handle);
+    }
+    ids[count++] = cs->id;
+    if(count == MAX_ACCEPT_BATCH) {
+        _actor_notify_accept(s->listen_id, ids, count, s->actor_handle);
+        count = 0;
+    }
+    return count;
+}
+
+
+// accept until EAGAIN, the accepted ids are reported by batch.
+// the edge of listener is not raised again for the backlog, so accept is retried at
+// next tick when it is failed.
+static void
+_socket_do_listen(struct socket_mgr_state* state, struct socket* s) {
+    struct socket_thread* t = get_thread(s);
+    int fd = s->fd;
+    int ids[MAX_ACCEPT_BATCH];
+    int count = 0;
+    int dropped = 0;
+    for(;;) {
+        int client_fd = _socket_accept(fd);
+        if(client_fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+            if(_socket_drop_accept(t, fd) >= 0) {
+                dropped++;
+                continue;
+            }
+        }
+        if(client_fd < 0) {
+            int err = errno;
+            if(err == EINTR || err == ECONNABORTED) {
+                continue;
+            }else if(err == EAGAIN || err == EWOULDBLOCK) {
+                break;
+            }
+            char buffer[MAX_ERROR_STRING];
+            sm_log("accept from socket id:%d is error[%d]:%s", s->id, err, _socket_strerror(err, buffer, sizeof(buffer)));
+            s->accept_retry = t->wheel.now + TIMEOUT_TICK;
+            _timeout_schedule(t, s);
+            break;
+        }
+        count = _socket_accepted(state, s, client_fd, ids, count);
+    }
+
+    if(count > 0) {
+        _actor_notify_accept(s->listen_id, ids, count, s->actor_handle);
+    }
+    if(dropped > 0) {
+        sm_log("socket id:%d drop %d connections, fd is exhausted", s->id, dropped);
+    }
+#ifdef SP_IO_URING
+    // the multishot accept stopped by an error is armed again when the backlog is drained
+    if(s->accept_retry == 0) {
+        _uring_accept(state, s);
+    }
+#endif
+}
+
+
+static struct socket_data*
+_recv_buffer_get(struct socket_thread* t, size_t size) {
+    struct socket_data* data = t->spare_recv.data;
+    if(data && t->spare_recv.size >= size) {
+        t->spare_recv.data = NULL;
+        t->spare_recv.size = 0;
+        return data;
+    }
+    return (struct socket_data*)hive_malloc(sizeof(struct socket_data) + size);
+}
+
+static void
+_recv_buffer_put(struct socket_thread* t, struct socket_data* data, size_t size) {
+    if(t->spare_recv.data == NULL || t->spare_recv.size < size) {
+        if(t->spare_recv.data) {
+            hive_free(t->spare_recv.data);
+        }
+        t->spare_recv.data = data;
+        t->spare_recv.size = size;
+    }else {
+        hive_free(data);
+    }
+}
+
+// read into a buffer of recv_size and give the buffer to actor, a read less than half
+// of it is copied. recv_size grow when the buffer is filled and shrink when it is less than half used.
+static int
+_socket_do_recv(struct socket_mgr_state* state, struct socket* s) {
+    struct socket_thread* t = get_thread(s);
+    int fd = s->fd;
+    int ret = SOCKET_OK;
+
+    // a paused socket leave the data in kernel until resume
+    while(!s->paused) {
+        size_t size = s->recv_size;
+        struct socket_data* data = _recv_buffer_get(t, size);
+        ssize_t n = read(fd, data->data, size);
+        if(n <= 0) {
+            _recv_buffer_put(t, data, size);
+        }
+
+        if(n < 0) {
+            int err = errno;
+            if(err == EAGAIN) {
+                break;
+            }else if(err == EINTR) {
+                continue;
+            }else {
+                char error_str[MAX_NOTIFY_STRING];
+                char buffer[MAX_ERROR_STRING];
+                snprintf(error_str, sizeof(error_str), "recv error[%d]: %s", err, _socket_strerror(err, buffer, sizeof(buffer)));
+                _actor_notify_error(s, error_str);
+                _socket_remove(state, s);
+                ret = SOCKET_ERROR;
+                break;
+            }
+        }else if (n == 0) {
+            _actor_notify_break(s);
+            _socket_remove(state, s);
+            ret = SOCKET_BREAK;
+            break;
+        }else {
+            s->last_read = t->wheel.now;
+            if((size_t)n == size) {
+                s->recv_size = (size*2 > MAX_RECV_BUFFER)?(MAX_RECV_BUFFER):(size*2);
+            }else if((size_t)n < size/2) {
+                s->recv_size = (size/2 < MIN_RECV_BUFFER)?(MIN_RECV_BUFFER):(size/2);
+                // the actor may keep the data, don't hold the rest of buffer with it
+                struct socket_data* copy = (struct socket_data*)hive_malloc(sizeof(struct socket_data) + n);
+                memcpy(copy->data, data->data, n);
+                _recv_buffer_put(t, data, size);
+                data = copy;
+            }
+            _actor_notify_recv(s, data, (size_t)n);
+        }
+    }
+    return ret;
+}
+
+
+// read datagrams by batch until the socket is drained, every datagram is a SE_UDP message
+static int
+_socket_do_recvfrom(struct socket_mgr_state* state, struct socket* s) {
+    struct socket_thread* t = get_thread(s);
+    if(t->udp_recv == NULL) {
+        t->udp_recv = (uint8_t*)hive_malloc(MAX_UDP_RECV * MAX_UDP_PACKET);
+    }
+    struct sockaddr_storage addrs[MAX_UDP_RECV];
+    struct iovec iov[MAX_UDP_RECV];
+    int fd = s->fd;
+    int i;
+    for(;;) {
+#ifdef __linux__
+        struct mmsghdr msgs[MAX_UDP_RECV];
+        for(i=0; i<MAX_UDP_RECV; i++) {
+            iov[i].iov_base = t->udp_recv + i*MAX_UDP_PACKET;
+            iov[i].iov_len = MAX_UDP_PACKET;
+            _udp_msghdr(&msgs[i].msg_hdr, &addrs[i], sizeof(addrs[i]), &iov[i]);
+            msgs[i].msg_len = 0;
+        }
+        int n = recvmmsg(fd, msgs, MAX_UDP_RECV, MSG_DONTWAIT, NULL);
+#else
+        socklen_t addr_len = sizeof(addrs[0]);
+        ssize_t sz = recvfrom(fd, t->udp_recv, MAX_UDP_PACKET, 0, (struct sockaddr*)&addrs[0], &addr_len);
+        int n = (sz < 0)?(-1):(1);
+#endif
+        if(n < 0) {
+            int err = errno;
+            if(err == EAGAIN || err == EWOULDBLOCK) {
+                break;
+            }else if(err == EINTR || err == ECONNREFUSED) {
+                // ECONNREFUSED is the icmp error of a former sendto
+                continue;
+            }
+            char error_str[MAX_NOTIFY_STRING];
+            char buffer[MAX_ERROR_STRING];
+            snprintf(error_str, sizeof(error_str), "recvfrom error[%d]: %s", err, _socket_strerror(err, buffer, sizeof(buffer)));
+            _actor_notify_error(s, error_str);
+            _socket_remove(state, s);
+            return SOCKET_ERROR;
+        }
+
+#ifdef __linux__
+        for(i=0; i<n; i++) {
+            _actor_notify_udp(s, t->udp_recv + i*MAX_UDP_PACKET, msgs[i].msg_len, &addrs[i], msgs[i].msg_hdr.msg_namelen);
+        }
+        if(n < MAX_UDP_RECV) {
+            break;
+        }
+#else
+        _actor_notify_udp(s, t->udp_recv, (size_t)sz, &addrs[0], addr_len);
+#endif
+    }
+    return SOCKET_OK;
+}
+
+
+static bool
+_socket_do_connect(struct socket_mgr_state* state, struct socket* s) {
+    const char* error_str = _socket_check_error(s);
+    if(error_str) {
+        _actor_notify_connected(s, error_str);
+        _socket_remove(state, s);
+        return false;
+    }else {
+        s->type = ST_FORWARD;
+        _actor_notify_connected(s, NULL);
+        s->last_read = get_thread(s)->wheel.now;
+        _timeout_schedule(get_thread(s), s);
+        return true;
+    }
+}
+
+
+static const char*
+_socket_check_error(struct socket* s) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    int code = getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    const char* error_str = NULL;
+    if(code < 0 || err) {
+        if(code >= 0) {
+            error_str = _socket_strerror(err, ERROR_BUFFER, sizeof(ERROR_BUFFER));
+        } else {
+            error_str = _socket_strerror(errno, ERROR_BUFFER, sizeof(ERROR_BUFFER));
+        }
+    }
+    return error_str;
+}
+
+
+// the pipe of data from s to its peer
+static bool
+_relay_open(struct socket* s) {
+#ifdef __linux__
+    return pipe2(s->relay_pipe, O_NONBLOCK | O_CLOEXEC) == 0;
+#else
+    s->relay_buffer = (uint8_t*)hive_malloc(RELAY_PIPE_SIZE);
+    return true;
+#endif
+}
+
+
+static void
+_relay_free(struct socket* s) {
+#ifdef __linux__
+    if(s->relay_pipe[0] >= 0) {
+        close(s->relay_pipe[0]);
+        close(s->relay_pipe[1]);
+        s->relay_pipe[0] = -1;
+        s->relay_pipe[1] = -1;
+    }
+#else
+    if(s->relay_buffer) {
+        hive_free(s->relay_buffer);
+        s->relay_buffer = NULL;
+    }
+    s->relay_offset = 0;
+#endif
+    s->relay_id = -1;
+    s->relay_state = RELAY_NONE;
+    s->relay_master = false;
+    s->relay_eof = false;
+    s->relay_piped = 0;
+    s->relay_bytes = 0;
+}
+
+
+// fill the empty pipe from socket, splice move the pages without copy to user space
+static ssize_t
+_relay_read(struct socket* s) {
+#ifdef __linux__
+    return splice(s->fd, NULL, s->relay_pipe[1], NULL, RELAY_PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+    s->relay_offset = 0;
+    return read(s->fd, s->relay_buffer, RELAY_PIPE_SIZE);
+#endif
+}
+
+
+static ssize_t
+_relay_write(struct socket* s, int fd) {
+#ifdef __linux__
+    return splice(s->relay_pipe[0], NULL, fd, NULL, s->relay_piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#else
+    ssize_t n = write(fd, s->relay_buffer + s->relay_offset, s->relay_piped);
+    if(n > 0) {
+        s->relay_offset += (size_t)n;
+    }
+    return n;
+#endif
+}
+
+
+// end the relay and remove both sockets, the end is notified by the master. return the peer
+static struct socket*
+_relay_close(struct socket_mgr_state* state, struct socket* s, const char* err) {
+    struct socket* p = get_socket(s->relay_id);
+    struct socket* m = (s->relay_master)?(s):(p);
+    struct socket* o = (m == s)?(p):(s);
+    _actor_notify_relay(m, m->relay_bytes, o->relay_bytes, err);
+    _socket_remove(state, s);
+    _socket_remove(state, p);
+    return p;
+}
+
+
+// move the data of s to peer until one side would block.
+// the relay is closed when both sides are eof or at any error, then return SOCKET_CLOSE
+static int
+_relay_pump(struct socket_mgr_state* state, struct socket* s, struct socket* p) {
+    // the data sent by actor is written before the relay data
+    if(s->relay_state != RELAY_RUN || !write_buffer_empty(p)) {
+        return SOCKET_OK;
+    }
+
+    uint64_t now = get_thread(s)->wheel.now;
+    for(;;) {
+        ssize_t n;
+        if(s->relay_piped > 0) {
+            n = _relay_write(s, p->fd);
+            if(n >= 0) {
+                s->relay_piped -= (size_t)n;
+                s->relay_bytes += (uint64_t)n;
+                p->last_write = now;
+                continue;
+            }
+        }else if(s->relay_eof) {
+            return SOCKET_OK;
+        }else {
+            n = _relay_read(s);
+            if(n > 0) {
+                s->relay_piped = (size_t)n;
+                s->last_read = now;
+                continue;
+            }else if(n == 0) {
+                // pass the half close to peer, the other direction goes on
+                s->relay_eof = true;
+                shutdown(p->fd, SHUT_WR);
+                if(p->relay_eof) {
+                    _relay_close(state, s, NULL);
+                    return SOCKET_CLOSE;
+                }
+                return SOCKET_OK;
+            }
+        }
+
+        int err = errno;
+        if(err == EINTR) {
+            continue;
+        }else if(err == EAGAIN || err == EWOULDBLOCK) {
+            return SOCKET_OK;
+        }
+        char error_str[MAX_NOTIFY_STRING];
+        char buffer[MAX_ERROR_STRING];
+        snprintf(error_str, sizeof(error_str), "relay error[%d]: %s", err, _socket_strerror(err, buffer, sizeof(buffer)));
+        _relay_close(state, s, error_str);
+        return SOCKET_CLOSE;
+    }
+}
+
+
+static void
+_actor_notify_recv(struct socket* s, struct socket_data* data, size_t size) {
+    data->u.size = size;
+    data->se = SE_RECIVE;
+    hive_send_nocopy(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)data, sizeof(struct socket_data)+size);
+}
+
+static void
+_actor_notify_string(struct socket* s, enum socket_event se, const char* str) {
+    uint8_t buffer[sizeof(struct socket_data) + MAX_NOTIFY_STRING];
+    struct socket_data* data = (struct socket_data*)buffer;
+    strncpy((char*)data->data, str, MAX_NOTIFY_STRING-1);
+    data->data[MAX_NOTIFY_STRING-1] = 0;
+    size_t size = strlen((char*)data->data)+1;
+    data->u.size = size;
+    data->se = se;
+    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)data, sizeof(struct socket_data)+size);
+}
+
+
+static void
+_actor_notify_break(struct socket* s) {
+    struct socket_data data;
+    data.se = SE_BREAK;
+    data.u.size = 0;
+    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)&data, sizeof(data));
+}
+
+static void
+_actor_notify_connected(struct socket* s, const char* err) {
+    if(err == NULL) {
+        struct socket_data data;
+        data.se = SE_CONNECTED;
+        data.u.size = 0;
+        hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)&data, sizeof(data));
+    } else {
+        _actor_notify_string(s, SE_CONNECTED, err);
+    }
+}
+
+
+static void
+_actor_notify_error(struct socket* s, const char* err) {
+    _actor_notify_string(s, SE_ERROR, err);
+}
+
+
+static void
+_actor_notify_watermark(struct socket* s, enum socket_event se, size_t queued) {
+    struct socket_data data;
+    data.se = se;
+    data.u.size = queued;
+    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)&data, sizeof(data));
+}
+
+
+// data is address length, address and the datagram
+static void
+_actor_notify_udp(struct socket* s, const uint8_t* data, size_t size, const struct sockaddr_storage* addr, socklen_t addr_len) {
+    size_t total = 1 + addr_len + size;
+    struct socket_data* sd = (struct socket_data*)hive_malloc(sizeof(struct socket_data) + total);
+    sd->se = SE_UDP;
+    sd->u.size = total;
+    sd->data[0] = (uint8_t)addr_len;
+    memcpy(sd->data + 1, addr, addr_len);
+    memcpy(sd->data + 1 + addr_len, data, size);
+    hive_send_nocopy(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)sd, sizeof(struct socket_data) + total);
+}
+
+
+static void
+_actor_notify_relay_ready(struct socket* s) {
+    struct socket_data data;
+    data.se = SE_RELAY_READY;
+    data.u.size = 0;
+    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)&data, sizeof(data));
+}
+
+
+// data is uint64 bytes sent, uint64 bytes received and the error string, it is empty at normal end
+static void
+_actor_notify_relay(struct socket* s, uint64_t sent, uint64_t received, const char* err) {
+    uint8_t buffer[sizeof(struct socket_data) + sizeof(uint64_t)*2 + MAX_NOTIFY_STRING];
+    struct socket_data* data = (struct socket_data*)buffer;
+    size_t len = (err)?(strnlen(err, MAX_NOTIFY_STRING-1)):(0);
+    memcpy(data->data, &sent, sizeof(sent));
+    memcpy(data->data + sizeof(sent), &received, sizeof(received));
+    if(len > 0) {
+        memcpy(data->data + sizeof(sent)*2, err, len);
+    }
+    data->se = SE_RELAY_END;
+    data->u.size = sizeof(uint64_t)*2 + len;
+    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)data, sizeof(struct socket_data) + data->u.size);
+}
+
+
+static void
+_actor_notify_accept(int server_id, const int* client_ids, int count, uint32_t target_handle) {
+    uint8_t buffer[sizeof(struct socket_data) + sizeof(int)*MAX_ACCEPT_BATCH];
+    struct socket_data* data = (struct socket_data*)buffer;
+    size_t size = sizeof(int)*count;
+    memcpy(data->data, client_ids, size);
+    data->u.size = (size_t)count;
+    data->se = SE_ACCEPT;
+    hive_send(SYS_HANDLE, target_handle, HIVE_TSOCKET, server_id, (void*)data, sizeof(struct socket_data)+size);
+}
+
+
+// the earliest deadline of the socket timeouts, 0 is none
+static uint64_t
+_timeout_deadline(struct socket_thread* t, struct socket* s) {
+    uint64_t deadline = 0;
+    switch(s->type) {
+        case ST_RESOLVING:
+        case ST_CONNECTING:
+        case ST_CONNECTED: {
+            if(s->connect_timeout > 0) {
+                deadline = s->created + s->connect_timeout;
+            }
+            break;
+        }
+
+        case ST_LISTEN: {
+            deadline = s->accept_retry;
+            break;
+        }
+
+        case ST_FORWARD: {
+            if(s->read_timeout > 0) {
+                // a paused socket is not read on purpose, but relay read it anyway
+                uint64_t last = (s->paused && s->relay_id < 0)?(t->wheel.now):(s->last_read);
+                deadline = last + s->read_timeout;
+            }
+            if(s->write_timeout > 0 && !write_buffer_empty(s)) {
+                uint64_t d = s->last_write + s->write_timeout;
+                if(deadline == 0 || d < deadline) {
+                    deadline = d;
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+    return deadline;
+}
+
+
+static void
+_timeout_link(struct socket_thread* t, struct socket* s, uint64_t expire) {
+    // the tick run already is checked at next tick
+    uint64_t tick = expire / TIMEOUT_TICK;
+    if(tick < t->wheel.tick) {
+        tick = t->wheel.tick;
+    }
+    int slot = (int)(tick % TIMEOUT_WHEEL_SIZE);
+    struct socket* head = t->wheel.slots[slot];
+    s->timeout_expire = expire;
+    s->timeout_slot = slot;
+    s->timeout_prev = NULL;
+    s->timeout_next = head;
+    if(head) {
+        head->timeout_prev = s;
+    }
+    t->wheel.slots[slot] = s;
+    t->wheel.count++;
+}
+
+
+static void
+_timeout_unlink(struct socket_thread* t, struct socket* s) {
+    if(s->timeout_slot == -1) {
+        return;
+    }
+    if(s->timeout_prev) {
+        s->timeout_prev->timeout_next = s->timeout_next;
+    }else if(s->timeout_slot == TIMEOUT_RUNNING) {
+        t->wheel.running = s->timeout_next;
+    }else {
+        t->wheel.slots[s->timeout_slot] = s->timeout_next;
+    }
+    if(s->timeout_next) {
+        s->timeout_next->timeout_prev = s->timeout_prev;
+    }
+    s->timeout_slot = -1;
+    s->timeout_prev = NULL;
+    s->timeout_next = NULL;
+    t->wheel.count--;
+}
+
+
+// the activity only delay the deadline, so a linked socket is moved only when the deadline is earlier
+static void
+_timeout_schedule(struct socket_thread* t, struct socket* s) {
+    uint64_t deadline = _timeout_deadline(t, s);
+    if(deadline == 0) {
+        _timeout_unlink(t, s);
+    }else if(s->timeout_slot < 0 || deadline < s->timeout_expire) {
+        _timeout_unlink(t, s);
+        _timeout_link(t, s, deadline);
+    }
+}
+
+
+static void
+_socket_timeout(struct socket_mgr_state* state, struct socket* s) {
+    switch(s->type) {
+        case ST_RESOLVING: {
+            // resolver thread may connect it at the same time
+            spinlock_lock(&s->lock);
+            bool resolving = (s->type == ST_RESOLVING);
+            if(resolving) {
+                _actor_notify_connected(s, "connect timeout");
+                s->type = ST_PREPARE;
+            }
+            spinlock_unlock(&s->lock);
+            if(resolving) {
+                _socket_remove(state, s);
+            }else {
+                _socket_timeout(state, s);
+            }
+            break;
+        }
+
+        case ST_CONNECTING:
+        case ST_CONNECTED: {
+            _actor_notify_connected(s, "connect timeout");
+            _socket_remove(state, s);
+            break;
+        }
+
+        case ST_LISTEN: {
+            s->accept_retry = 0;
+            _socket_do_listen(state, s);
+            break;
+        }
+
+        case ST_FORWARD: {
+            uint64_t now = get_thread(s)->wheel.now;
+            bool paused = s->paused && s->relay_id < 0;
+            bool read_expired = s->read_timeout > 0 && !paused && s->last_read + s->read_timeout <= now;
+            const char* err = (read_expired)?("read timeout"):("write timeout");
+            if(s->relay_id >= 0) {
+                _relay_close(state, s, err);
+            }else {
+                _actor_notify_error(s, err);
+                _socket_remove(state, s);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+// run the ticks until now, the socket not expired yet is linked again by its deadline
+static void
+_timeout_update(struct socket_mgr_state* state, struct socket_thread* t) {
+    uint64_t now = t->wheel.now;
+    uint64_t target = now / TIMEOUT_TICK;
+    if(t->wheel.count == 0) {
+        t->wheel.tick = target + 1;
+        return;
+    }
+    if(target >= t->wheel.tick + TIMEOUT_WHEEL_SIZE) {
+        t->wheel.tick = target - TIMEOUT_WHEEL_SIZE + 1;
+    }
+
+    // the expired socket may remove its relay peer from the running list
+    while(t->wheel.tick <= target) {
+        int slot = (int)(t->wheel.tick % TIMEOUT_WHEEL_SIZE);
+        struct socket* s;
+        t->wheel.running = t->wheel.slots[slot];
+        t->wheel.slots[slot] = NULL;
+        t->wheel.tick++;
+        for(s=t->wheel.running; s; s=s->timeout_next) {
+            s->timeout_slot = TIMEOUT_RUNNING;
+        }
+        while((s = t->wheel.running) != NULL) {
+            _timeout_unlink(t, s);
+
+            if(s->timeout_expire > now) {
+                _timeout_link(t, s, s->timeout_expire);
+                continue;
+            }
+            uint64_t deadline = _timeout_deadline(t, s);
+            if(deadline > now) {
+                _timeout_link(t, s, deadline);
+            }else if(deadline > 0) {
+                _socket_timeout(state, s);
+            }
+        }
+    }
+}
+
+
+// wait until the next tick when any socket is in wheel
+static int
+_timeout_wait(struct socket_thread* t) {
+    if(t->wheel.count == 0) {
+        return -1;
+    }
+    uint64_t next = t->wheel.tick * TIMEOUT_TICK;
+    uint64_t now = _now();
+    return (next > now)?((int)(next - now)):(0);
+}
+
+
+#ifdef SP_IO_URING
+// the op of s is not queued when the submission ring is full, it is armed again
+// by the loop after the ring is flushed. the slot of s is kept until then.
+static void
+_uring_pending(struct socket_thread* t, struct socket* s) {
+    if(s->uring_pending) {
+        return;
+    }
+    s->uring_pending = true;
+    s->uring_pending_next = t->uring_pending;
+    t->uring_pending = s;
+    s->uring_ops++;
+}
+
+
+static void
+_uring_accept(struct socket_mgr_state* state, struct socket* s) {
+    struct socket_thread* t = get_thread(s);
+    if(!sp_completion(t->pfd) || s->type != ST_LISTEN || s->uring_accept) {
+        return;
+    }
+    if(sp_accept(t->pfd, s->fd, s) != 0) {
+        _uring_pending(t, s);
+        return;
+    }
+    s->uring_accept = true;
+    s->uring_ops++;
 }
 
 
-static int
-_socket_getaddr(struct socket_mgr_state* state, struct socket* s, struct socket_addrinfo* out_addrinfo, const char** out_error) {
-    int fd = s->fd;
-    struct sockaddr addr;
-    socklen_t len = sizeof(addr);
-    int err = getsockname(fd, &addr, &len);
-    if(err < 0) {
-        *out_error = strerror(errno);
-        return 1;
+// a paused or held socket is not armed, the data is left in kernel
+static void
+_uring_recv(struct socket_mgr_state* state, struct socket* s) {
+    struct socket_thread* t = get_thread(s);
+    if(!sp_completion(t->pfd) || s->type != ST_FORWARD || s->relay_id >= 0 ||
+        s->uring_recv || s->uring_hold || s->paused) {
+        return;
     }
-
-    char str_port[NI_MAXSERV];
-    err = getnameinfo(&addr, len, out_addrinfo->ip, sizeof(out_addrinfo->ip), 
-        str_port, sizeof(str_port), NI_NUMERICHOST | NI_NUMERICSERV);
-    if(err != 0) {
-        *out_error = gai_strerror(err);
-        return 1;
+    if(sp_recv(t->pfd, s->fd, s) != 0) {
+        _uring_pending(t, s);
+        return;
     }
-    
-    out_addrinfo->port = atoi(str_port);
-    return 0;
+    s->uring_recv = true;
+    s->uring_ops++;
 }
 
 
+// link the blocks at head of write buffer into one chain, the next chain is sent
+// when all of its completions are handled. must hold the socket lock.
+static void
+_uring_send(struct socket_mgr_state* state, struct socket* s) {
+    if(s->uring_sending > 0) {
+        return;
+    }
+    struct iovec iov[MAX_URING_SEND];
+    int count = 0;
+    struct buffer_block* b;
+    for(b=s->write_buffer.head; b && count<MAX_URING_SEND; b=b->next, count++) {
+        iov[count].iov_base = b->buffer + b->offset;
+        iov[count].iov_len = b->sz - b->offset;
+    }
+    if(count == 0) {
+        return;
+    }
+    // the short chain is continued by its completions, nothing queued wait the loop
+    struct socket_thread* t = get_thread(s);
+    count = sp_send(t->pfd, s->fd, s, iov, count);
+    if(count == 0) {
+        _uring_pending(t, s);
+        return;
+    }
+    s->uring_sending = count;
+    s->uring_ops += count;
+}
 
 
+// stop the multishot recv, the completions queued before it are still handled
 static void
-_socket_do_listen(struct socket_mgr_state* state, struct socket* s) {
-    int fd = s->fd;
-    int client_fd = accept(fd, NULL, NULL);
-    if(client_fd < 0) {
-        sm_log("accept from socket id:%d is error[%d]:%s", s->id, errno, strerror(errno));
+_uring_cancel(struct socket_mgr_state* state, struct socket* s) {
+    struct socket_thread* t = get_thread(s);
+    if(!s->uring_recv || s->uring_cancel) {
+        return;
+    }
+    if(sp_cancel(t->pfd, s, SP_OP_RECV) != 0) {
+        _uring_pending(t, s);
         return;
     }
+    s->uring_cancel = true;
+}
 
-    struct socket* cs = _socket_gen(state);
-    if(cs == NULL) {
-        sm_log("socket id poll is full.");
-        close(client_fd);
+
+// an op of s is completed. the last one free the slot of a closed socket,
+// or run the relay request waiting for it.
+static void
+_uring_done(struct socket_mgr_state* state, struct socket* s) {
+    assert(s->uring_ops > 0);
+    if(--s->uring_ops > 0) {
         return;
     }
+    struct request_package* msg = s->uring_defer;
+    s->uring_defer = NULL;
+    if(s->type == ST_INVALID) {
+        if(msg) {
+            hive_free(msg);
+        }
+        spinlock_lock(&state->slot_lock);
+        _slot_push_free(state, s);
+        spinlock_unlock(&state->slot_lock);
+    }else if(msg) {
+        _request_send(state, msg);
+        hive_free(msg);
+    }
+}
 
-    cs->fd = client_fd;
-    cs->actor_handle = SYS_HANDLE;
-    cs->type = ST_PREPARE;
-    sp_nonblocking(client_fd);
-    _actor_notify_accept(s->id, cs->id, s->actor_handle);
+
+// give the filled buffer back to kernel, return the data for actor.
+// the buffer more than half filled is given to actor, the less one is copied.
+static struct socket_data*
+_uring_recv_data(struct socket_thread* t, int bid, int size) {
+    struct socket_data* data = t->uring_buffers[bid];
+    if(size > URING_RECV_BUFFER/2) {
+        t->uring_buffers[bid] = (struct socket_data*)hive_malloc(sizeof(struct socket_data) + URING_RECV_BUFFER);
+    }else if(size > 0) {
+        struct socket_data* copy = (struct socket_data*)hive_malloc(sizeof(struct socket_data) + size);
+        memcpy(copy->data, data->data, size);
+        data = copy;
+    }else {
+        data = NULL;
+    }
+    sp_provide(t->pfd, bid, t->uring_buffers[bid]->data, URING_RECV_BUFFER);
+    return data;
 }
 
 
+// the accepted fds of a listener are reported in one batch, return the index of last one
 static int
-_socket_do_recv(struct socket_mgr_state* state, struct socket* s) {
-    int fd = s->fd;
-    int ret = SOCKET_OK;
-
-    for(;;) {
-        ssize_t n = read(fd, state->_recv_data->data, MAX_RECV_BUFFER);
-        // printf("_socket_do_recv id:%d fd:%d n:%zd\n", s->id, fd, n);
-        if(n < 0) {
-            int err = errno;
-            if(err == EAGAIN) {
-                break;
-            }else if(err == EINTR) {
-                continue;
+_uring_accept_done(struct socket_mgr_state* state, struct socket_thread* t, int idx, int n) {
+    struct socket* s = (struct socket*)t->sp_event[idx].s;
+    int ids[MAX_ACCEPT_BATCH];
+    int count = 0;
+    int done = 0;
+    bool failed = false;
+    for(; idx<n; idx++) {
+        struct event* e = &(t->sp_event[idx]);
+        if(e->s != s || e->op != SP_OP_ACCEPT) {
+            break;
+        }
+        if(!(e->flags & IORING_CQE_F_MORE)) {
+            s->uring_accept = false;
+            done++;
+        }
+        if(e->res >= 0) {
+            if(s->type == ST_LISTEN) {
+                count = _socket_accepted(state, s, e->res, ids, count);
             }else {
-                int len = snprintf((char*)state->_recv_data->data, MAX_RECV_BUFFER, "recv error[%d]: %s", err, strerror(err));
-                assert(len > 0);
-                // printf("recv_error:%s s:%p id:%d fd:%d\n", (char*)state->_recv_data->data, s, s->id, s->fd);
-                _actor_notify_error(state, s, (size_t)(len+1));
-                _socket_remove(state, s);
-                ret = SOCKET_ERROR;
-                break;
+                close(e->res);
             }
-        }else if (n == 0) {
-            _actor_notify_break(s);
-            // printf("recv_break s:%p id:%d fd:%d\n", s, s->id, s->fd);
-            _socket_remove(state, s);
-            ret = SOCKET_BREAK;
-            break;
+        }else if(e->res != -ECANCELED) {
+            failed = true;
+        }
+    }
+
+    if(count > 0) {
+        _actor_notify_accept(s->listen_id, ids, count, s->actor_handle);
+    }
+    // the error is handled by accept, it drop the client when fd is exhausted
+    if(s->type == ST_LISTEN && !s->uring_accept) {
+        if(failed) {
+            _socket_do_listen(state, s);
         }else {
-            _actor_notify_recv(state, s, (size_t)n);
+            _uring_accept(state, s);
         }
     }
-    return ret;
+    while(done-- > 0) {
+        _uring_done(state, s);
+    }
+    return idx - 1;
 }
 
 
-static bool
-_socket_do_connect(struct socket_mgr_state* state, struct socket* s) {
-    const char* error_str = _socket_check_error(s);
-    if(error_str) {
-        _actor_notify_connected(state, s, error_str);
-        _socket_remove(state, s);
-        return false;
-    }else {
-        s->type = ST_FORWARD;
-        if(write_buffer_empty(s)) {
-            sp_write(state->pfd, s->fd, s, false);
+static void
+_uring_recv_done(struct socket_mgr_state* state, struct socket_thread* t, int idx, int n) {
+    struct event* e = &(t->sp_event[idx]);
+    struct socket* s = (struct socket*)e->s;
+    int res = e->res;
+    bool more = (e->flags & IORING_CQE_F_MORE) != 0;
+    struct socket_data* data = NULL;
+    if(e->flags & IORING_CQE_F_BUFFER) {
+        data = _uring_recv_data(t, (int)(e->flags >> IORING_CQE_BUFFER_SHIFT), res);
+    }
+    if(!more) {
+        s->uring_recv = false;
+        s->uring_cancel = false;
+    }
+
+    if(s->type != ST_FORWARD) {
+        if(data) {
+            hive_free(data);
         }
-        _actor_notify_connected(state, s, NULL);
-        return true;
+    }else if(res > 0) {
+        s->last_read = t->wheel.now;
+        _actor_notify_recv(s, data, (size_t)res);
+        // the data is left in kernel until resume
+        if(s->paused) {
+            _uring_cancel(state, s);
+        }
+    }else if(res == 0) {
+        _actor_notify_break(s);
+        _socket_remove(state, s);
+        _socket_event_clear(t, idx, n, s);
+    }else if(res != -ENOBUFS && res != -ECANCELED && res != -EINTR) {
+        char error_str[MAX_NOTIFY_STRING];
+        char buffer[MAX_ERROR_STRING];
+        snprintf(error_str, sizeof(error_str), "recv error[%d]: %s", -res, _socket_strerror(-res, buffer, sizeof(buffer)));
+        _actor_notify_error(s, error_str);
+        _socket_remove(state, s);
+        _socket_event_clear(t, idx, n, s);
+    }
+
+    // multishot recv is stopped by kernel when the provided buffers run out
+    _uring_recv(state, s);
+    if(!more) {
+        _uring_done(state, s);
     }
 }
 
 
-static const char*
-_socket_check_error(struct socket* s) {
+// the completions of a chain come in order, every one is for the head block
+static void
+_uring_send_done(struct socket_mgr_state* state, struct socket_thread* t, int idx, int n) {
+    struct event* e = &(t->sp_event[idx]);
+    struct socket* s = (struct socket*)e->s;
+    int res = e->res;
+    bool invalid = (s->type == ST_INVALID);
     int err = 0;
-    socklen_t len = sizeof(err);
-    int code = getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
-    const char* error_str = NULL;
-    if(code < 0 || err) {
-        if(code >= 0) {
-            error_str = strerror(err);
-        } else {
-            error_str = strerror(errno);
+
+    spinlock_lock(&s->lock);
+    s->uring_sending--;
+    struct buffer_block* b = s->write_buffer.head;
+    if(res > 0 && !invalid) {
+        ATOM_SUB(&s->send_queued, (size_t)res);
+        s->last_write = t->wheel.now;
+        b->offset += (size_t)res;
+    }else if(res < 0 && res != -ECANCELED && res != -EINTR && !invalid) {
+        err = -res;
+    }
+    // the short one stop the chain, it is sent again by next chain
+    if(b && (invalid || b->offset == b->sz)) {
+        s->write_buffer.head = b->next;
+        if(b->next == NULL) {
+            s->write_buffer.tail = NULL;
         }
+        hive_free(b);
     }
-    return error_str;
-}
-
+    if(!invalid && err == 0 && s->type == ST_FORWARD) {
+        _uring_send(state, s);
+    }
+    spinlock_unlock(&s->lock);
 
-static void
-_actor_notify_recv(struct socket_mgr_state* state, struct socket* s, size_t size) {
-    state->_recv_data->u.size = size;
-    state->_recv_data->se = SE_RECIVE;
-    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)state->_recv_data, sizeof(struct socket_data)+size);
+    if(err) {
+        char error_str[MAX_NOTIFY_STRING];
+        char buffer[MAX_ERROR_STRING];
+        snprintf(error_str, sizeof(error_str), "send error[%d]: %s", err, _socket_strerror(err, buffer, sizeof(buffer)));
+        if(s->relay_id >= 0) {
+            struct socket* p = _relay_close(state, s, error_str);
+            _socket_event_clear(t, idx, n, p);
+        }else {
+            _actor_notify_error(s, error_str);
+            _socket_remove(state, s);
+        }
+        _socket_event_clear(t, idx, n, s);
+    }else if(s->type == ST_FORWARD) {
+        _socket_check_watermark(s);
+        // the relay data of peer wait the data sent by actor
+        if(s->relay_id >= 0 && write_buffer_empty(s)) {
+            struct socket* p = get_socket(s->relay_id);
+            if(_relay_pump(state, p, s) != SOCKET_OK) {
+                _socket_event_clear(t, idx, n, s);
+                _socket_event_clear(t, idx, n, p);
+            }
+        }
+    }
+    _uring_done(state, s);
 }
 
 
+// arm the ops of sockets waiting for the submission ring, the ring is flushed
+// by the wait of last round.
 static void
-_actor_notify_break(struct socket* s) {
-    struct socket_data data;
-    data.se = SE_BREAK;
-    data.u.size = 0;
-    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)&data, sizeof(data));
+_uring_flush(struct socket_mgr_state* state, struct socket_thread* t) {
+    struct socket* s = t->uring_pending;
+    t->uring_pending = NULL;
+    while(s) {
+        struct socket* next = s->uring_pending_next;
+        s->uring_pending_next = NULL;
+        s->uring_pending = false;
+        if(s->type == ST_LISTEN) {
+            _uring_accept(state, s);
+        }else if(s->type == ST_FORWARD) {
+            _uring_recv(state, s);
+            if(s->paused || s->uring_hold) {
+                _uring_cancel(state, s);
+            }
+            spinlock_lock(&s->lock);
+            _uring_send(state, s);
+            spinlock_unlock(&s->lock);
+        }
+        _uring_done(state, s);
+        s = next;
+    }
 }
 
-static void
-_actor_notify_connected(struct socket_mgr_state* state, struct socket* s, const char* err) {
-    if(err == NULL) {
-        struct socket_data data;
-        data.se = SE_CONNECTED;
-        data.u.size = 0;
-        hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)&data, sizeof(data));
-    } else {
-        strncpy((char*)state->_recv_data->data, err, MAX_RECV_BUFFER-1);
-        size_t size = strlen((char*)state->_recv_data->data)+1;
-        state->_recv_data->u.size = size;
-        state->_recv_data->se = SE_CONNECTED;
-        hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)state->_recv_data, sizeof(struct socket_data)+size);
+
+// handle the completion at idx, return the index of last event handled
+static int
+_uring_complete(struct socket_mgr_state* state, struct socket_thread* t, int idx, int n) {
+    switch(t->sp_event[idx].op) {
+        case SP_OP_ACCEPT:
+            return _uring_accept_done(state, t, idx, n);
+        case SP_OP_RECV:
+            _uring_recv_done(state, t, idx, n);
+            break;
+        case SP_OP_SEND:
+            _uring_send_done(state, t, idx, n);
+            break;
+        default:
+            hive_panic("socket_mgr: invalid completion op:%d.\n", t->sp_event[idx].op);
     }
+    return idx;
 }
+#endif
 
 
-static void
-_actor_notify_error(struct socket_mgr_state* state, struct socket* s, size_t size) {
-    state->_recv_data->u.size = size;
-    state->_recv_data->se = SE_ERROR;
-    hive_send(SYS_HANDLE, s->actor_handle, HIVE_TSOCKET, s->id, (void*)state->_recv_data, sizeof(struct socket_data)+size);
+// stop the completions of s before relay, the data received is delivered before SE_RELAY_READY.
+// return 0 when s is ready, 1 when msg is run again after the ops of s are completed,
+// -1 when another request is waiting for s.
+static int
+_relay_hold(struct socket_mgr_state* state, struct socket* s, struct request_package* msg) {
+#ifdef SP_IO_URING
+    struct socket_thread* t = get_thread(s);
+    if(!sp_completion(t->pfd)) {
+        return 0;
+    }
+    s->uring_hold = true;
+    if(s->uring_ops == 0) {
+        return 0;
+    }
+    if(s->uring_defer) {
+        return -1;
+    }
+    _uring_cancel(state, s);
+    s->uring_defer = (struct request_package*)hive_malloc(PKG_SIZE);
+    *s->uring_defer = *msg;
+    return 1;
+#else
+    return 0;
+#endif
 }
 
 
+// the relay is refused, read s again
 static void
-_actor_notify_accept(int server_id, int client_id, uint32_t target_handle) {
-    struct socket_data data;
-    data.u.id = client_id;
-    data.se = SE_ACCEPT;
-    hive_send(SYS_HANDLE, target_handle, HIVE_TSOCKET, server_id, (void*)&data, sizeof(data));
+_relay_unhold(struct socket_mgr_state* state, struct socket* s) {
+#ifdef SP_IO_URING
+    if(s->uring_hold) {
+        s->uring_hold = false;
+        _uring_recv(state, s);
+    }
+#endif
 }
 
 
 static int
-_socket_request_ctrl(struct socket_mgr_state* state, struct request_package* msg) {
+_socket_request_ctrl(struct socket_mgr_state* state, struct socket_thread* t, struct request_package* msg) {
     enum request_type type = msg->type;
     if(type == REQ_EXIT) {
         return -1;
@@ -856,27 +3211,40 @@ _socket_request_ctrl(struct socket_mgr_state* state, struct request_package* msg
 
     // invalid socket id
     if(s->type == ST_INVALID || s->id != id) {
+        if(type == REQ_SEND) {
+            hive_free(msg->v.msgsend.block);
+        }
+        return SOCKET_OK;
+    }
+
+    // the socket is moved by relay after the request is sent
+    if(get_thread(s) != t) {
+        _request_push_thread(get_thread(s), msg);
         return SOCKET_OK;
     }
 
     // printf("request_ctrl s:%p id:%d fd:%d type:%d\n", s, s->id, s->fd, type);
     switch(type) {
         case REQ_LISTEN: {
-            sp_add(state->pfd, s->fd, s);
+            _socket_watch(state, s);
             break;
         }
 
         case REQ_CONNECT: {
-            sp_add(state->pfd, s->fd, s);
-            if(s->type == ST_CONNECTED) {
+            // the connecting socket is finished at the write event
+            if(s->type != ST_CONNECTED) {
+                sp_add(get_thread(s)->pfd, s->fd, s);
+            }else {
                 s->type = ST_FORWARD;
-                if(!write_buffer_empty(s)) {
-                    sp_write(state->pfd, s->fd, s, true);
-                }
-                _actor_notify_connected(state, s, NULL);
-            }else if(s->type == ST_CONNECTING) {
-                sp_write(state->pfd, s->fd, s, true);
+                _socket_watch(state, s);
+                spinlock_lock(&s->lock);
+                _socket_do_send(state, s);
+                spinlock_unlock(&s->lock);
+                _actor_notify_connected(s, NULL);
+                _socket_check_watermark(s);
+                s->last_read = get_thread(s)->wheel.now;
             }
+            _timeout_schedule(get_thread(s), s);
             break;
         }
 
@@ -888,18 +3256,185 @@ _socket_request_ctrl(struct socket_mgr_state* state, struct request_package* msg
         }
 
         case REQ_CLOSE: {
+            if(s->relay_id >= 0) {
+                struct socket* p = _relay_close(state, s, "relay is closed");
+                _insert_close_socket(t, s);
+                _insert_close_socket(t, p);
+                return SOCKET_CLOSE;
+            }
+            int listen_next = s->listen_next;
             _socket_remove(state, s);
-            _insert_close_socket(state, s);
+            _insert_close_socket(get_thread(s), s);
+            if(listen_next >= 0) {
+                _request_close(state, listen_next);
+            }
             return SOCKET_CLOSE;
         }
 
+        case REQ_TIMEOUT: {
+            s->connect_timeout = msg->v.timeout.connect;
+            s->read_timeout = msg->v.timeout.read;
+            s->write_timeout = msg->v.timeout.write;
+            _timeout_schedule(get_thread(s), s);
+            break;
+        }
+
+        case REQ_WATERMARK: {
+            s->send_high = msg->v.watermark.high;
+            s->send_low = msg->v.watermark.low;
+            // the bytes queued already may cross the new ones
+            _socket_check_watermark(s);
+            break;
+        }
+
+        case REQ_RESUME: {
+            s->last_read = get_thread(s)->wheel.now;
+#ifdef SP_IO_URING
+            if(sp_completion(t->pfd)) {
+                _uring_recv(state, s);
+                break;
+            }
+#endif
+            if(s->type == ST_FORWARD && s->relay_id < 0 && _socket_do_recv(state, s) != SOCKET_OK) {
+                _insert_close_socket(get_thread(s), s);
+                return SOCKET_CLOSE;
+            }
+            break;
+        }
+
         case REQ_SEND: {
             struct buffer_block* block = msg->v.msgsend.block;
             if(s->type == ST_INVALID) {
                 hive_free(block);
+            }else if(s->relay_state == RELAY_RUN) {
+                // sent after relay_start, it may land in the middle of the spliced data
+                sm_log("socket id:%d is relaying, drop %zu bytes sent", s->id, block->sz - block->offset);
+                ATOM_SUB(&s->send_queued, block->sz - block->offset);
+                ATOM_DEC(&s->send_pending);
+                hive_free(block);
             }else {
+                // no more write edge if the socket is writable already, so try write now
+                spinlock_lock(&s->lock);
+                bool idle = write_buffer_empty(s);
                 _buffer_append(s, block);
-                sp_write(state->pfd, s->fd, s, true);
+                ATOM_DEC(&s->send_pending);
+                if(idle) {
+                    s->last_write = get_thread(s)->wheel.now;
+                }
+                if(s->type == ST_FORWARD) {
+                    _socket_do_send(state, s);
+                }else if(s->type == ST_UDP) {
+                    _socket_do_sendto(state, s);
+                }
+                spinlock_unlock(&s->lock);
+                _socket_check_watermark(s);
+                if(idle && s->write_timeout > 0) {
+                    _timeout_schedule(get_thread(s), s);
+                }
+            }
+            break;
+        }
+
+        case REQ_RELAY: {
+            struct socket* p = get_socket(msg->v.relay_id);
+            if(s->relay_state == RELAY_MOVE) {
+                s->relay_state = RELAY_NONE;
+                _socket_watch(state, s);
+                _timeout_schedule(t, s);
+            }
+            if(s->type != ST_FORWARD || s->relay_id >= 0 || p->id != msg->v.relay_id || p->type != ST_FORWARD) {
+                if(s->type == ST_FORWARD && s->relay_id < 0) {
+                    _relay_unhold(state, s);
+                }
+                _actor_notify_relay(s, 0, 0, "invalid relay socket");
+                break;
+            }
+
+            // move to the thread of peer, and clear its events of this batch
+            if(p->thread != s->thread) {
+                // the completions of s must not come to this thread after the move
+                int hold = _relay_hold(state, s, msg);
+                if(hold > 0) {
+                    break;
+                }else if(hold < 0) {
+                    _actor_notify_relay(s, 0, 0, "invalid relay socket");
+                    break;
+                }
+                sp_del(t->pfd, s->fd);
+                _timeout_unlink(t, s);
+                s->relay_state = RELAY_MOVE;
+                s->thread = p->thread;
+                _request_push_thread(get_thread(s), msg);
+                _insert_close_socket(t, s);
+                return SOCKET_CLOSE;
+            }
+
+            if(p->relay_id >= 0 || p->relay_state != RELAY_NONE) {
+                _relay_unhold(state, s);
+                _actor_notify_relay(s, 0, 0, "invalid relay socket");
+                break;
+            }
+
+            // the data received before SE_RELAY_READY is delivered to actor
+            int hold = _relay_hold(state, s, msg);
+            if(hold == 0) {
+                hold = _relay_hold(state, p, msg);
+            }
+            if(hold > 0) {
+                break;
+            }else if(hold < 0) {
+                _relay_unhold(state, s);
+                _actor_notify_relay(s, 0, 0, "invalid relay socket");
+                break;
+            }
+            if(!_relay_open(s) || !_relay_open(p)) {
+                char error_str[MAX_NOTIFY_STRING];
+                char buffer[MAX_ERROR_STRING];
+                snprintf(error_str, sizeof(error_str), "relay pipe error: %s", _socket_strerror(errno, buffer, sizeof(buffer)));
+                _relay_free(s);
+                _relay_free(p);
+                _relay_unhold(state, s);
+                _relay_unhold(state, p);
+                _actor_notify_relay(s, 0, 0, error_str);
+                break;
+            }
+            // sendv of actor read them under the lock
+            spinlock_lock(&s->lock);
+            s->relay_id = p->id;
+            s->relay_master = true;
+            s->relay_state = RELAY_HOLD;
+            spinlock_unlock(&s->lock);
+            spinlock_lock(&p->lock);
+            p->relay_id = s->id;
+            p->relay_state = RELAY_HOLD;
+            spinlock_unlock(&p->lock);
+#ifdef SP_IO_URING
+            // splice of relay wait the readiness of both sockets
+            if(sp_completion(t->pfd)) {
+                sp_add(t->pfd, s->fd, s);
+                sp_add(t->pfd, p->fd, p);
+            }
+#endif
+            _actor_notify_relay_ready(s);
+            break;
+        }
+
+        case REQ_RELAY_START: {
+            if(s->relay_state != RELAY_HOLD) {
+                break;
+            }
+            struct socket* p = get_socket(s->relay_id);
+            spinlock_lock(&s->lock);
+            s->relay_state = RELAY_RUN;
+            spinlock_unlock(&s->lock);
+            spinlock_lock(&p->lock);
+            p->relay_state = RELAY_RUN;
+            spinlock_unlock(&p->lock);
+            // the edges at hold are not handled, so pump both sides now
+            if(_relay_pump(state, s, p) != SOCKET_OK || _relay_pump(state, p, s) != SOCKET_OK) {
+                _insert_close_socket(t, s);
+                _insert_close_socket(t, p);
+                return SOCKET_CLOSE;
             }
             break;
         }
@@ -913,43 +3448,59 @@ _socket_request_ctrl(struct socket_mgr_state* state, struct request_package* msg
 }
 
 
+// take all queued requests in one swap and run them in push order.
+// the doorbell is cleared before the swap, so a push after it rings again.
 static int
-_socket_do_ctrl(struct socket_mgr_state* state) {
-    int fd = state->recvctrl_fd;
-    struct request_package msg;
+_socket_do_ctrl(struct socket_mgr_state* state, struct socket_thread* t) {
+    int result = SOCKET_OK;
+    _doorbell_clear(t);
+
+    struct request_package* head;
+    do {
+        head = t->request_head;
+    } while(!ATOM_CAS_POINTER(&t->request_head, head, NULL));
+
+    struct request_package* list = NULL;
+    while(head) {
+        struct request_package* next = head->next;
+        head->next = list;
+        list = head;
+        head = next;
+    }
 
-    for(;;) {
-        int n = read(fd, &msg, PKG_SIZE);
-        if(n < 0) {
-            int err = errno;
-            if(err == EAGAIN) {
-                break;
-            }else if (err == EINTR) {
-                continue;
-            }else {
-                hive_panic("socket pipe control read a error:%d", err);
-            }
-        }else if(n == 0){
-            hive_panic("socket pip control read request len is 0");
-        }else if (n == PKG_SIZE) {
-            int ret = _socket_request_ctrl(state, &msg);
-            if(ret != SOCKET_OK) {
-                return ret;
+    while(list) {
+        struct request_package* req = list;
+        list = req->next;
+        int ret = _socket_request_ctrl(state, t, req);
+        hive_free(req);
+        if(ret < 0) {
+            // keep the rest for socket_mgr_release
+            while(list) {
+                struct request_package* next = list->next;
+                _request_push(t, list);
+                list = next;
             }
-        }else {
-            hive_panic("socket pip control read request lens: %d is invalid", n);
+            return ret;
+        }else if(ret != SOCKET_OK) {
+            result = ret;
         }
     }
-    return SOCKET_OK;
+    return result;
 }
 
 
 static void
-_socket_event_clear(struct socket_mgr_state* state, int idx, int n, struct socket* close_s) {
+_socket_event_clear(struct socket_thread* t, int idx, int n, struct socket* close_s) {
     int i;
     for(i=idx+1; i<n; i++) {
-        struct event* e = &(state->sp_event[i]);
+        struct event* e = &(t->sp_event[i]);
         struct socket* s = (struct socket*)e->s;
+#ifdef SP_IO_URING
+        // the slot of completion is kept until it is handled
+        if(e->op != SP_OP_POLL) {
+            continue;
+        }
+#endif
         if(s == close_s) {
             e->s = NULL;
             e->write = false;
@@ -960,25 +3511,35 @@ _socket_event_clear(struct socket_mgr_state* state, int idx, int n, struct socke
 
 
 int
-socket_mgr_update(struct socket_mgr_state* state) {
-    int n = sp_wait(state->pfd, state->sp_event, MAX_SP_EVENT);
-    if(n <= 0) {
+socket_mgr_update(struct socket_mgr_state* state, int thread) {
+    assert(thread >= 0 && thread < state->thread_count);
+    struct socket_thread* t = &state->threads[thread];
+    int timeout = _timeout_wait(t);
+#ifdef SP_IO_URING
+    // the ops waiting for the submission ring are armed after the ring is flushed
+    if(t->uring_pending) {
+        timeout = 0;
+    }
+#endif
+    int n = sp_wait(t->pfd, t->sp_event, MAX_SP_EVENT, timeout);
+    if(n < 0) {
         int err = errno;
         if(err == EINTR) {
             return 0;
         }
         hive_panic("socket_mgr update sp_wait error:%d errno:%d\n", n, err);
     }
+    t->wheel.now = _now();
 
     /* // for teset kqueue and epoll
     {
         int i, j;
         for(i=0; i<n; i++) {
-            struct event* e1 = &(state->sp_event[i]);
+            struct event* e1 = &(t->sp_event[i]);
             struct socket* s1 = (struct socket*)e1->s;
             for(j=0; j<n; j++) {
                 if(i == j) continue;
-                struct event* e2 = &(state->sp_event[j]);
+                struct event* e2 = &(t->sp_event[j]);
                 struct socket* s2 = (struct socket*)e2->s;
                 if(s1 == s2) {
                     printf("duplicate_event [%d] read:%d write:%d --> [%d] read:%d write:%d\n",
@@ -991,32 +3552,39 @@ socket_mgr_update(struct socket_mgr_state* state) {
 
     int idx;
     for(idx=0; idx<n; idx++) {
-        struct event* e = &(state->sp_event[idx]);
+        struct event* e = &(t->sp_event[idx]);
         struct socket* s = (struct socket*)e->s;
         // printf("[%d] count:%d event:%p s:%p id:%d fd:%d read:%d write:%d\n", idx, n, e, s, 
         //     (s)?(s->id):(-1), (s)?(s->fd):(-1), e->read, e->write);
 
-        // pipe control request event
+#ifdef SP_IO_URING
+        if(e->op != SP_OP_POLL) {
+            idx = _uring_complete(state, t, idx, n);
+            continue;
+        }
+#endif
+
+        // request queue doorbell event
         if(s == NULL) {
             if(e->error) {
-                hive_panic("socket pipe control is error.");
+                hive_panic("socket request doorbell is error.");
             }else if(e->read) {
-                _clear_close_socket(state);
-                int ret = _socket_do_ctrl(state);
+                _clear_close_socket(t);
+                int ret = _socket_do_ctrl(state, t);
                 if(ret < 0) {
-                    _clear_close_socket(state);
+                    _clear_close_socket(t);
                     return ret;
                 }else if(ret == SOCKET_CLOSE) {
                     // remove closed socket
                     size_t i;
-                    for(i=0; i<state->prepare_close_sockets.idx; i++) {
-                        struct socket* close_s = state->prepare_close_sockets.slots[i];
-                        _socket_event_clear(state, idx, n, close_s);
+                    for(i=0; i<t->prepare_close_sockets.idx; i++) {
+                        struct socket* close_s = t->prepare_close_sockets.slots[i];
+                        _socket_event_clear(t, idx, n, close_s);
                     }
                 }else if(ret != SOCKET_OK){
                     hive_panic("invalid socket ctrl type:%d", ret);
                 }
-                _clear_close_socket(state);
+                _clear_close_socket(t);
                 continue;
             }else {
                 continue;
@@ -1026,11 +3594,15 @@ socket_mgr_update(struct socket_mgr_state* state) {
         // socket event
         enum socket_type stype = s->type;
 
-        // check kqueue eof event
+        // check kqueue eof event, relay read the rest and pass the eof to peer
         if (e->eof) {
-            _actor_notify_break(s);
-            _socket_remove(state, s);
-            continue;
+            if(s->relay_id >= 0) {
+                e->read = true;
+            }else {
+                _actor_notify_break(s);
+                _socket_remove(state, s);
+                continue;
+            }
         }
 
         // check socket connect
@@ -1039,6 +3611,18 @@ socket_mgr_update(struct socket_mgr_state* state) {
                 continue;
             }
             stype = s->type;
+#ifdef SP_IO_URING
+            // the connected socket is driven by completions from now on
+            if(sp_completion(t->pfd)) {
+                sp_del(t->pfd, s->fd);
+                _socket_watch(state, s);
+                spinlock_lock(&s->lock);
+                _socket_do_send(state, s);
+                spinlock_unlock(&s->lock);
+                _socket_check_watermark(s);
+                continue;
+            }
+#endif
         }
 
         if(e->read) {
@@ -1049,6 +3633,14 @@ socket_mgr_update(struct socket_mgr_state* state) {
                 }
 
                 case ST_FORWARD: {
+                    if(s->relay_id >= 0) {
+                        struct socket* p = get_socket(s->relay_id);
+                        if(_relay_pump(state, s, p) != SOCKET_OK) {
+                            _socket_event_clear(t, idx, n, p);
+                            continue;
+                        }
+                        break;
+                    }
                     int ret = _socket_do_recv(state, s);
                     if(ret != SOCKET_OK && e->write) {
                         continue;
@@ -1056,6 +3648,13 @@ socket_mgr_update(struct socket_mgr_state* state) {
                     break;
                 }
 
+                case ST_UDP: {
+                    if(_socket_do_recvfrom(state, s) != SOCKET_OK) {
+                        continue;
+                    }
+                    break;
+                }
+
                 default:{
                     hive_panic("invalid  socket type: %d recv read event.", stype);
                     break;
@@ -1063,22 +3662,26 @@ socket_mgr_update(struct socket_mgr_state* state) {
             }
         }
 
-        if(e->write) {
-            switch(stype) {
-                case ST_FORWARD: {
-                    if(spinlock_trylock(&s->lock)) {
-                        _socket_do_send(state, s);
-                        if(write_buffer_empty(s)) {
-                            sp_write(state->pfd, s->fd, s, false);
-                        }
-                        spinlock_unlock(&s->lock);
-                    }
-                    break;
+        // write event is edge triggered, so wait the lock rather than miss it.
+        // only socket thread fill the write buffer, so an empty one need not the lock.
+        if(e->write && (stype == ST_FORWARD || stype == ST_UDP)) {
+            if(!write_buffer_empty(s)) {
+                spinlock_lock(&s->lock);
+                if(stype == ST_FORWARD) {
+                    _socket_do_send(state, s);
+                }else {
+                    _socket_do_sendto(state, s);
                 }
+                spinlock_unlock(&s->lock);
+                _socket_check_watermark(s);
+            }
 
-                default:{
-                    hive_panic("invalid  socket type: %d recv write event.", stype);
-                    break;
+            // the relay data of peer wait this socket writable
+            if(s->relay_id >= 0) {
+                struct socket* p = get_socket(s->relay_id);
+                if(_relay_pump(state, p, s) != SOCKET_OK) {
+                    _socket_event_clear(t, idx, n, p);
+                    continue;
                 }
             }
         }
@@ -1088,11 +3691,19 @@ socket_mgr_update(struct socket_mgr_state* state) {
             if(error_str == NULL) {
                 error_str = "unknow error";
             }
-            strncpy((char*)state->_recv_data->data, error_str, MAX_RECV_BUFFER-1);
-            _actor_notify_error(state, s, strlen((char*)state->_recv_data->data)+1);
-            _socket_remove(state, s);
+            if(s->relay_id >= 0) {
+                struct socket* p = _relay_close(state, s, error_str);
+                _socket_event_clear(t, idx, n, p);
+            }else {
+                _actor_notify_error(s, error_str);
+                _socket_remove(state, s);
+            }
         }
     }
 
+#ifdef SP_IO_URING
+    _uring_flush(state, t);
+#endif
+    _timeout_update(state, t);
     return 0;
 }
@@ -6,18 +6,38 @@
 struct socket_mgr_state;
 
 
-struct socket_mgr_state* socket_mgr_create();
+// thread_count socket threads call socket_mgr_update with their index,
+// max_socket is the capacity of live sockets, slots are allocated on demand.
+// resolver_count resolver threads call socket_mgr_resolve.
+struct socket_mgr_state* socket_mgr_create(int thread_count, int max_socket, int resolver_count);
+int socket_mgr_thread_count(struct socket_mgr_state* state);
+int socket_mgr_resolver_count(struct socket_mgr_state* state);
 void socket_mgr_release(struct socket_mgr_state* state);
 void socket_mgr_exit(struct socket_mgr_state* state);
 
-int socket_mgr_connect(struct socket_mgr_state* state, const char* host, uint16_t port, char const** out_err, uint32_t actor_handle);
-int socket_mgr_listen(struct socket_mgr_state* state, const char* host, uint16_t port, uint32_t actor_handle);
+// opt is NULL for default options
+int socket_mgr_connect(struct socket_mgr_state* state, const char* host, uint16_t port, char const** out_err, uint32_t actor_handle, const struct socket_opt* opt);
+int socket_mgr_listen(struct socket_mgr_state* state, const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt);
+int socket_mgr_connect_unix(struct socket_mgr_state* state, const char* path, char const** out_err, uint32_t actor_handle, const struct socket_opt* opt);
+int socket_mgr_listen_unix(struct socket_mgr_state* state, const char* path, uint32_t actor_handle, const struct socket_opt* opt);
 int socket_mgr_send(struct socket_mgr_state* state, int id, const void* data, size_t size);
+int socket_mgr_sendv(struct socket_mgr_state* state, int id, const struct iovec* iov, int count);
+int socket_mgr_udp(struct socket_mgr_state* state, const char* host, uint16_t port, uint32_t actor_handle, const struct socket_opt* opt, char const** out_err);
+int socket_mgr_sendto(struct socket_mgr_state* state, int id, const void* addr, size_t addr_len, const struct iovec* iov, int count);
+int socket_mgr_watermark(struct socket_mgr_state* state, int id, size_t high, size_t low);
+int64_t socket_mgr_queued(struct socket_mgr_state* state, int id);
+int socket_mgr_timeout(struct socket_mgr_state* state, int id, int connect_ms, int read_ms, int write_ms);
+int socket_mgr_relay(struct socket_mgr_state* state, int id, int peer_id);
+int socket_mgr_relay_start(struct socket_mgr_state* state, int id);
+int socket_mgr_pause(struct socket_mgr_state* state, int id);
+int socket_mgr_resume(struct socket_mgr_state* state, int id);
 int socket_mgr_close(struct socket_mgr_state* state, int id);
 int socket_mgr_attach(struct socket_mgr_state* state, int id, uint32_t actor_handle);
 int socket_mgr_addrinfo(struct socket_mgr_state* state, int id, struct socket_addrinfo* out_addrinfo, const char** out_error);
 
-int socket_mgr_update(struct socket_mgr_state* state);
+int socket_mgr_update(struct socket_mgr_state* state, int thread);
+// resolve one connect host name, block until there is one. return -1 at exit.
+int socket_mgr_resolve(struct socket_mgr_state* state);
 
 
 #endif
\ No newline at end of file
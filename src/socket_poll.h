@@ -2,8 +2,34 @@
 #define _SOCKET_POLL_H_
 
 #include <stdbool.h>
+#include <sys/uio.h>
 
+#if defined(__linux__) && defined(HIVE_IO_URING) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        // multishot recv and cancel by fd
+        #if defined(IORING_RECV_MULTISHOT) && defined(IORING_ASYNC_CANCEL_FD)
+            #define SP_IO_URING
+        #endif
+    #endif
+#endif
+
+#ifdef SP_IO_URING
+typedef struct sp_uring* poll_fd;
+#else
 typedef int poll_fd;
+#endif
+
+#ifdef SP_IO_URING
+// the op of io_uring is in low bits of user data, ud must be aligned by 4
+#define SP_OP_POLL 0
+#define SP_OP_ACCEPT 1
+#define SP_OP_RECV 2
+#define SP_OP_SEND 3
+#define SP_OP_MASK 3
+// provided buffers of multishot recv, it must be power of 2
+#define SP_URING_BUFFERS 256
+#endif
 
 struct event {
 	void * s;
@@ -11,20 +37,43 @@ struct event {
 	bool read;
 	bool write;
 	bool error;
+#ifdef SP_IO_URING
+    int op;             // SP_OP_POLL is a readiness event, the others are completions
+    int res;            // res and flags of the cqe
+    unsigned flags;
+#endif
 };
 
 static bool sp_invalid(poll_fd fd);
 static poll_fd sp_create();
 static void sp_release(poll_fd fd);
+// edge triggered read and write events, the caller must read and write until EAGAIN
 static int sp_add(poll_fd fd, int sock, void *ud);
 static void sp_del(poll_fd fd, int sock);
-static void sp_write(poll_fd, int sock, void *ud, bool enable);
-static int sp_wait(poll_fd, struct event *e, int max);
+// timeout is ms, -1 is wait forever. return 0 when timeout
+static int sp_wait(poll_fd, struct event *e, int max, int timeout);
 static void sp_nonblocking(int sock);
 
+#ifdef SP_IO_URING
+// false when the ring can not be setup and epoll is used
+static bool sp_completion(poll_fd fd);
+// multishot accept and recv, they are armed until a completion without IORING_CQE_F_MORE
+static int sp_accept(poll_fd fd, int sock, void* ud);
+static int sp_recv(poll_fd fd, int sock, void* ud);
+// linked sends, return the count queued
+static int sp_send(poll_fd fd, int sock, void* ud, const struct iovec* iov, int count);
+static int sp_cancel(poll_fd fd, void* ud, int op);
+// give the buffer back to multishot recv
+static void sp_provide(poll_fd fd, int bid, void* addr, unsigned len);
+#endif
+
 #ifdef __linux__
+#ifdef SP_IO_URING
+#include "socket_uring.h"
+#else
 #include "socket_epoll.h"
 #endif
+#endif
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #include "socket_kqueue.h"
@@ -0,0 +1,562 @@
+#ifndef poll_socket_uring_h
+#define poll_socket_uring_h
+
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <time.h>
+#include <linux/io_uring.h>
+
+// io_uring backend: the sockets waiting readiness are armed once with a multishot poll,
+// accept, recv and send are completion ops reported by sp_wait with the result of cqe.
+// every op is queued in the submission ring and handed to the kernel
+// by the same io_uring_enter that waits for events.
+// fallback to epoll when the kernel can not setup the ring.
+
+#define SP_URING_ENTRIES 1024
+#define SP_URING_CQ_ENTRIES 8192
+#define SP_URING_IGNORE ((uint64_t)-1)
+#define SP_URING_MASK (EPOLLIN | EPOLLOUT | EPOLLRDHUP)
+#define SP_URING_BGID 0
+// user data of poll is gen<<34 | fd<<2, the gen is cut to 30 bits
+#define SP_URING_GEN_MASK 0x3fffffffu
+
+struct sp_uring_fd {
+	void* ud;
+	uint32_t gen;
+	bool used;
+};
+
+struct sp_uring {
+	int ring_fd;
+	int epoll_fd;
+
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned sq_entries;
+
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* ring_ptr;
+	size_t ring_len;
+	size_t sqes_len;
+
+	// provided buffers of multishot recv, the kernel pick one for every completion
+	struct io_uring_buf_ring* br;
+	size_t br_len;
+	uint16_t br_tail;
+
+	// registered fd of poll
+	struct sp_uring_fd* fds;
+	int fds_size;
+};
+
+static bool
+sp_invalid(struct sp_uring* u) {
+	return u == NULL;
+}
+
+static void
+_sp_uring_close(struct sp_uring* u) {
+	if(u->br) {
+		munmap(u->br, u->br_len);
+	}
+	if(u->sqes) {
+		munmap(u->sqes, u->sqes_len);
+	}
+	if(u->ring_ptr) {
+		munmap(u->ring_ptr, u->ring_len);
+	}
+	close(u->ring_fd);
+	u->br = NULL;
+	u->sqes = NULL;
+	u->ring_ptr = NULL;
+	u->ring_fd = -1;
+}
+
+// multishot recv came with the same kernel as IORING_OP_SEND_ZC
+static bool
+_sp_uring_probe(int fd) {
+	size_t len = sizeof(struct io_uring_probe) + 256*sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* probe = (struct io_uring_probe*)hive_malloc(len);
+	memset(probe, 0, len);
+	bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+		probe->last_op >= IORING_OP_SEND_ZC &&
+		(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) != 0;
+	hive_free(probe);
+	return ok;
+}
+
+static bool
+_sp_uring_setup(struct sp_uring* u) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = SP_URING_CQ_ENTRIES;
+	int fd = (int)syscall(__NR_io_uring_setup, SP_URING_ENTRIES, &p);
+	if(fd < 0) {
+		return false;
+	}
+
+	// multishot poll came with the same kernel as IORING_FEAT_RSRC_TAGS
+	unsigned need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+	if((p.features & need) != need || !_sp_uring_probe(fd)) {
+		close(fd);
+		return false;
+	}
+	u->ring_fd = fd;
+
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	size_t ring_len = (sq_len > cq_len)?(sq_len):(cq_len);
+	char* ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(ring == MAP_FAILED) {
+		_sp_uring_close(u);
+		return false;
+	}
+	u->ring_ptr = ring;
+	u->ring_len = ring_len;
+
+	size_t sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED) {
+		_sp_uring_close(u);
+		return false;
+	}
+	u->sqes = sqes;
+	u->sqes_len = sqes_len;
+
+	size_t br_len = SP_URING_BUFFERS * sizeof(struct io_uring_buf);
+	void* br = mmap(NULL, br_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(br == MAP_FAILED) {
+		_sp_uring_close(u);
+		return false;
+	}
+	u->br = (struct io_uring_buf_ring*)br;
+	u->br_len = br_len;
+	u->br_tail = 0;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)br;
+	reg.ring_entries = SP_URING_BUFFERS;
+	reg.bgid = SP_URING_BGID;
+	if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		_sp_uring_close(u);
+		return false;
+	}
+
+	u->sq_entries = p.sq_entries;
+	u->sq_head = (unsigned*)(ring + p.sq_off.head);
+	u->sq_tail = (unsigned*)(ring + p.sq_off.tail);
+	u->sq_mask = (unsigned*)(ring + p.sq_off.ring_mask);
+	u->sq_array = (unsigned*)(ring + p.sq_off.array);
+	u->cq_head = (unsigned*)(ring + p.cq_off.head);
+	u->cq_tail = (unsigned*)(ring + p.cq_off.tail);
+	u->cq_mask = (unsigned*)(ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+	return true;
+}
+
+static struct sp_uring*
+sp_create() {
+	struct sp_uring* u = (struct sp_uring*)hive_malloc(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	u->ring_fd = -1;
+	u->epoll_fd = -1;
+	if(!_sp_uring_setup(u)) {
+		u->epoll_fd = epoll_create(1024);
+		if(u->epoll_fd == -1) {
+			hive_free(u);
+			return NULL;
+		}
+	}
+	return u;
+}
+
+static void
+sp_release(struct sp_uring* u) {
+	if(u->ring_fd >= 0) {
+		_sp_uring_close(u);
+	}else {
+		close(u->epoll_fd);
+	}
+	if(u->fds) {
+		hive_free(u->fds);
+	}
+	hive_free(u);
+}
+
+static bool
+sp_completion(struct sp_uring* u) {
+	return u->ring_fd >= 0;
+}
+
+static int
+_sp_uring_submit(struct sp_uring* u, unsigned wait, int timeout) {
+	unsigned tail = *u->sq_tail;
+	unsigned pending = tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	unsigned flags = (wait)?(IORING_ENTER_GETEVENTS):(0);
+	if(pending == 0 && wait == 0) {
+		return 0;
+	}
+	if(wait == 0 || timeout < 0) {
+		return (int)syscall(__NR_io_uring_enter, u->ring_fd, pending, wait, flags, NULL, 0);
+	}
+
+	struct __kernel_timespec ts;
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+	return (int)syscall(__NR_io_uring_enter, u->ring_fd, pending, wait, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+// free entries of submission ring, hand the queued ones to kernel when there are not enough
+static unsigned
+_sp_uring_space(struct sp_uring* u, unsigned need) {
+	unsigned space = u->sq_entries - (*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE));
+	if(space < need) {
+		_sp_uring_submit(u, 0, -1);
+		space = u->sq_entries - (*u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE));
+	}
+	return space;
+}
+
+static struct io_uring_sqe*
+_sp_uring_sqe(struct sp_uring* u) {
+	if(_sp_uring_space(u, 1) == 0) {
+		return NULL;
+	}
+	unsigned idx = *u->sq_tail & *u->sq_mask;
+	struct io_uring_sqe* sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	return sqe;
+}
+
+static void
+_sp_uring_commit(struct sp_uring* u) {
+	__atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t
+_sp_uring_poll_data(struct sp_uring* u, int sock) {
+	return ((uint64_t)(u->fds[sock].gen & SP_URING_GEN_MASK) << 34) | ((uint64_t)(uint32_t)sock << 2) | SP_OP_POLL;
+}
+
+static int
+_sp_uring_arm(struct sp_uring* u, int sock) {
+	struct io_uring_sqe* sqe = _sp_uring_sqe(u);
+	if(sqe == NULL) {
+		return 1;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sock;
+	sqe->poll32_events = SP_URING_MASK;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = _sp_uring_poll_data(u, sock);
+	_sp_uring_commit(u);
+	return 0;
+}
+
+static int
+sp_add(struct sp_uring* u, int sock, void *ud) {
+	if(u->ring_fd < 0) {
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.ptr = ud;
+		if(epoll_ctl(u->epoll_fd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+			return 1;
+		}
+		return 0;
+	}
+
+	if(sock < 0) {
+		return 1;
+	}
+	if(sock >= u->fds_size) {
+		int size = (u->fds_size)?(u->fds_size):(64);
+		while(size <= sock) {
+			size *= 2;
+		}
+		struct sp_uring_fd* fds = (struct sp_uring_fd*)hive_malloc(sizeof(struct sp_uring_fd)*size);
+		memset(fds, 0, sizeof(struct sp_uring_fd)*size);
+		if(u->fds) {
+			memcpy(fds, u->fds, sizeof(struct sp_uring_fd)*u->fds_size);
+			hive_free(u->fds);
+		}
+		u->fds = fds;
+		u->fds_size = size;
+	}
+
+	struct sp_uring_fd* f = &u->fds[sock];
+	if(f->used) {
+		return 1;
+	}
+	f->gen++;
+	f->ud = ud;
+	f->used = true;
+	if(_sp_uring_arm(u, sock)) {
+		f->used = false;
+		return 1;
+	}
+	return 0;
+}
+
+static void
+sp_del(struct sp_uring* u, int sock) {
+	if(u->ring_fd < 0) {
+		epoll_ctl(u->epoll_fd, EPOLL_CTL_DEL, sock , NULL);
+		return;
+	}
+
+	if(sock >= 0 && sock < u->fds_size && u->fds[sock].used) {
+		u->fds[sock].used = false;
+		u->fds[sock].ud = NULL;
+	}
+
+	// cancel the poll and every completion op of the fd
+	struct io_uring_sqe* sqe = _sp_uring_sqe(u);
+	if(sqe) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = sock;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = SP_URING_IGNORE;
+		_sp_uring_commit(u);
+	}
+	// the requests hold a reference of the file, remove them before the caller close fd
+	_sp_uring_submit(u, 0, -1);
+}
+
+static int
+sp_accept(struct sp_uring* u, int sock, void* ud) {
+	struct io_uring_sqe* sqe = _sp_uring_sqe(u);
+	if(sqe == NULL) {
+		return 1;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = (uint64_t)(uintptr_t)ud | SP_OP_ACCEPT;
+	_sp_uring_commit(u);
+	return 0;
+}
+
+static int
+sp_recv(struct sp_uring* u, int sock, void* ud) {
+	struct io_uring_sqe* sqe = _sp_uring_sqe(u);
+	if(sqe == NULL) {
+		return 1;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SP_URING_BGID;
+	sqe->user_data = (uint64_t)(uintptr_t)ud | SP_OP_RECV;
+	_sp_uring_commit(u);
+	return 0;
+}
+
+// the sends are linked in one submission, so they are written in order.
+// MSG_WAITALL retry a short send, then a send fail cancel the rest of chain.
+// return the count queued, it is less than count when the submission ring is full.
+static int
+sp_send(struct sp_uring* u, int sock, void* ud, const struct iovec* iov, int count) {
+	unsigned space = _sp_uring_space(u, (unsigned)count);
+	if(space < (unsigned)count) {
+		count = (int)space;
+	}
+	int i;
+	for(i=0; i<count; i++) {
+		struct io_uring_sqe* sqe = _sp_uring_sqe(u);
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = sock;
+		sqe->addr = (uint64_t)(uintptr_t)iov[i].iov_base;
+		sqe->len = (uint32_t)iov[i].iov_len;
+		sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+		sqe->flags = (i < count-1)?(IOSQE_IO_LINK):(0);
+		sqe->user_data = (uint64_t)(uintptr_t)ud | SP_OP_SEND;
+		_sp_uring_commit(u);
+	}
+	return count;
+}
+
+static int
+sp_cancel(struct sp_uring* u, void* ud, int op) {
+	struct io_uring_sqe* sqe = _sp_uring_sqe(u);
+	if(sqe == NULL) {
+		return 1;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)ud | (uint64_t)op;
+	sqe->user_data = SP_URING_IGNORE;
+	_sp_uring_commit(u);
+	return 0;
+}
+
+static void
+sp_provide(struct sp_uring* u, int bid, void* addr, unsigned len) {
+	struct io_uring_buf* buf = &u->br->bufs[u->br_tail & (SP_URING_BUFFERS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)addr;
+	buf->len = len;
+	buf->bid = (uint16_t)bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+_sp_uring_reap(struct sp_uring* u, struct event *e, int max) {
+	int n = 0;
+	unsigned head = *u->cq_head;
+	unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	while(head != tail && n < max) {
+		struct io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+		uint64_t user_data = cqe->user_data;
+		int res = cqe->res;
+		unsigned cflags = cqe->flags;
+		head++;
+
+		if(user_data == SP_URING_IGNORE) {
+			continue;
+		}
+		int op = (int)(user_data & SP_OP_MASK);
+		if(op != SP_OP_POLL) {
+			e[n].s = (void*)(uintptr_t)(user_data & ~(uint64_t)SP_OP_MASK);
+			e[n].op = op;
+			e[n].res = res;
+			e[n].flags = cflags;
+			e[n].read = false;
+			e[n].write = false;
+			e[n].error = false;
+			e[n].eof = false;
+			n++;
+			continue;
+		}
+
+		int sock = (int)(uint32_t)(user_data >> 2);
+		uint32_t gen = (uint32_t)(user_data >> 34);
+		if(sock >= u->fds_size || !u->fds[sock].used || (u->fds[sock].gen & SP_URING_GEN_MASK) != gen) {
+			continue;
+		}
+
+		struct sp_uring_fd* f = &u->fds[sock];
+		if(!(cflags & IORING_CQE_F_MORE) && (res >= 0 || res == -ECANCELED)) {
+			// multishot poll is terminated by kernel, arm it again
+			_sp_uring_arm(u, sock);
+		}
+		if(res <= 0) {
+			if(res == -ECANCELED || res == 0) {
+				continue;
+			}
+			res = EPOLLERR;
+		}
+
+		// a fd may be polled more than once in a batch, merge them as epoll does
+		int i;
+		for(i=0; i<n; i++) {
+			if(e[i].s == f->ud && e[i].op == SP_OP_POLL) {
+				break;
+			}
+		}
+		if(i == n) {
+			e[i].s = f->ud;
+			e[i].op = SP_OP_POLL;
+			e[i].res = 0;
+			e[i].flags = 0;
+			e[i].write = false;
+			e[i].read = false;
+			e[i].error = false;
+			e[i].eof = false;
+			n++;
+		}
+		e[i].write |= (res & EPOLLOUT) != 0;
+		e[i].read |= (res & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) != 0;
+		e[i].error |= (res & EPOLLERR) != 0;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+static uint64_t
+_sp_uring_now() {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec*1000 + ti.tv_nsec/1000000;
+}
+
+static int
+sp_wait(struct sp_uring* u, struct event *e, int max, int timeout) {
+	if(u->ring_fd < 0) {
+		struct epoll_event ev[max];
+		int n = epoll_wait(u->epoll_fd, ev, max, timeout);
+		int i;
+		for (i=0;i<n;i++) {
+			e[i].s = ev[i].data.ptr;
+			unsigned flag = ev[i].events;
+			e[i].op = SP_OP_POLL;
+			e[i].res = 0;
+			e[i].flags = 0;
+			e[i].write = (flag & EPOLLOUT) != 0;
+			e[i].read = (flag & (EPOLLIN | EPOLLHUP)) != 0;
+			e[i].error = (flag & EPOLLERR) != 0;
+			e[i].eof = false;
+		}
+		return n;
+	}
+
+	// the completions of cancel are dropped, keep the deadline of caller across them
+	uint64_t deadline = (timeout > 0)?(_sp_uring_now() + timeout):(0);
+	for(;;) {
+		int n = _sp_uring_reap(u, e, max);
+		if(n > 0) {
+			// the ops queued by last events are not delayed by a busy completion ring
+			_sp_uring_submit(u, 0, -1);
+			return n;
+		}
+		if(timeout > 0) {
+			uint64_t now = _sp_uring_now();
+			timeout = (deadline > now)?((int)(deadline - now)):(0);
+		}
+		// submit queued ops, then sleep until one completion
+		if(_sp_uring_submit(u, 1, timeout) < 0) {
+			if(errno == ETIME) {
+				return 0;
+			}else if(errno != EBUSY) {
+				return -1;
+			}
+		}
+	}
+}
+
+static void
+sp_nonblocking(int fd) {
+	int flag = fcntl(fd, F_GETFL, 0);
+	if ( -1 == flag ) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, flag | O_NONBLOCK);
+}
+
+#endif
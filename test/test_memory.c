@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define HIVE_MEMORY_TYPE HIVE_MEMORY_TIMER
+#include "hive_memory.h"
+
+
+static void
+_dump_stat() {
+    struct hive_memory_stat stat[HIVE_MEMORY_TYPE_COUNT];
+    hive_memory_stat(stat);
+    int i=0;
+    for(i=0; i<HIVE_MEMORY_TYPE_COUNT; i++) {
+        printf("%s bytes:%lld count:%lld\n", hive_memory_typename(i),
+            (long long)stat[i].bytes, (long long)stat[i].count);
+    }
+}
+
+
+static void*
+_thread_alloc(void* p) {
+    void** out = (void**)p;
+    out[0] = hive_malloc(100);
+    out[1] = hive_calloc(4, 25);
+    return NULL;
+}
+
+
+static void
+_check_stat(const struct hive_memory_stat* base, int type, int64_t bytes, int64_t count) {
+    struct hive_memory_stat stat[HIVE_MEMORY_TYPE_COUNT];
+    hive_memory_stat(stat);
+    int i=0;
+    for(i=0; i<HIVE_MEMORY_TYPE_COUNT; i++) {
+        int64_t b = (i == type)?(bytes):(0);
+        int64_t c = (i == type)?(count):(0);
+        assert(stat[i].bytes - base[i].bytes == b);
+        assert(stat[i].count - base[i].count == c);
+    }
+}
+
+
+int 
+main(int argc, char const *argv[]) {
+    struct hive_memory_stat base[HIVE_MEMORY_TYPE_COUNT];
+    hive_memory_stat(base);
+
+    void* p[2];
+    pthread_t pid;
+    pthread_create(&pid, NULL, _thread_alloc, p);
+    pthread_join(pid, NULL);
+
+    // the counters of the exited thread are still in the sum
+    _check_stat(base, HIVE_MEMORY_TIMER, 200, 2);
+
+    void* q = hive_malloc(10);
+    _check_stat(base, HIVE_MEMORY_TIMER, 210, 3);
+    q = hive_realloc(q, 50);
+    _check_stat(base, HIVE_MEMORY_TIMER, 250, 3);
+    hive_memory_account(HIVE_MEMORY_LUA, 32, 1);
+    printf("---- alloc ----\n");
+    _dump_stat();
+    struct hive_memory_stat stat[HIVE_MEMORY_TYPE_COUNT];
+    hive_memory_stat(stat);
+    assert(stat[HIVE_MEMORY_LUA].bytes - base[HIVE_MEMORY_LUA].bytes == 32);
+    assert(stat[HIVE_MEMORY_LUA].count - base[HIVE_MEMORY_LUA].count == 1);
+
+    // free from other thread
+    hive_free(p[0]);
+    hive_free(p[1]);
+    hive_free(q);
+    _check_stat(base, HIVE_MEMORY_LUA, 32, 1);
+    hive_memory_account(HIVE_MEMORY_LUA, -32, -1);
+    printf("---- free ----\n");
+    _dump_stat();
+    _check_stat(base, HIVE_MEMORY_TIMER, 0, 0);
+
+    hive_memdump();
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "hive.h"
+#include "hive_timer.h"
+
+#define HANDLE 1
+#define MAX_SESSION 64
+
+static struct timer_state* T = NULL;
+static int fired[MAX_SESSION];         // expired count of session
+static uint64_t fired_time[MAX_SESSION];
+static int cancel_session = -1;         // removed at its first dispatch
+
+
+static void
+_fire(int session, int count) {
+    assert(session >= 0 && session < MAX_SESSION);
+    if(fired[session] == 0) {
+        fired_time[session] = hive_timer_gettime();
+    }
+    fired[session] += count;
+    if(session == cancel_session) {
+        bool ok = hive_timer_remove(T, session, HANDLE);
+        printf("cancel session:%d in dispatch:%d\n", session, ok);
+        assert(ok);
+        cancel_session = -1;
+    }
+}
+
+// the timer is dispatched by hive_send, it is caught here instead of the actor
+bool
+hive_send(uint32_t source, uint32_t target, int type, int session, void* data, size_t size) {
+    assert(target == HANDLE && type == HIVE_TTIMER);
+    if(data == NULL) {
+        _fire(session, 1);
+    }else {
+        const int* pairs = (const int*)data;
+        size_t i;
+        assert(size == sizeof(int)*2*session);
+        for(i=0; i<(size_t)session; i++) {
+            _fire(pairs[2*i], pairs[2*i+1]);
+        }
+    }
+    return true;
+}
+
+
+static void
+_run(uint32_t ms) {
+    uint64_t end = hive_timer_gettime() + ms;
+    while(hive_timer_gettime() < end) {
+        usleep(500);
+        hive_timer_update(T);
+    }
+}
+
+
+static void
+_test_insert_remove() {
+    memset(fired, 0, sizeof(fired));
+    int s1 = hive_timer_insert(T, 5, 0, HANDLE);
+    int s2 = hive_timer_insert(T, 5, 0, HANDLE);
+    int s3 = hive_timer_insert(T, 10, 0, HANDLE);
+    assert(hive_timer_remove(T, s2, HANDLE));
+    assert(!hive_timer_remove(T, s2, HANDLE));
+    assert(!hive_timer_remove(T, s3, HANDLE+1));
+    _run(30);
+    printf("insert remove: s1:%d s2:%d s3:%d\n", fired[s1], fired[s2], fired[s3]);
+    assert(fired[s1] == 1 && fired[s2] == 0 && fired[s3] == 1);
+    assert(fired_time[s1] <= fired_time[s3]);
+    // the expired one shot timer is gone
+    assert(!hive_timer_remove(T, s1, HANDLE));
+}
+
+
+// beyond NEAR(256) ticks the timer is in level wheel and moved to near wheel by shift
+static void
+_test_level_wheel() {
+    memset(fired, 0, sizeof(fired));
+    uint32_t offsets[] = {255, 256, 257, 300, 600};
+    int sessions[5];
+    int i;
+    uint64_t start = hive_timer_gettime();
+    for(i=0; i<5; i++) {
+        sessions[i] = hive_timer_insert(T, offsets[i], 0, HANDLE);
+    }
+    _run(700);
+    for(i=0; i<5; i++) {
+        int s = sessions[i];
+        uint64_t elapsed = fired_time[s] - start;
+        printf("level wheel: offset:%u fired:%d elapsed:%llu\n", offsets[i], fired[s], (unsigned long long)elapsed);
+        assert(fired[s] == 1);
+        assert(elapsed + 1 >= offsets[i]);
+    }
+}
+
+
+// the periods missed when update is late are fold into one dispatch
+static void
+_test_interval_fold() {
+    memset(fired, 0, sizeof(fired));
+    int s = hive_timer_insert(T, 5, 5, HANDLE);
+    usleep(60*1000);
+    hive_timer_update(T);
+    printf("interval fold: count:%d after 60ms\n", fired[s]);
+    assert(fired[s] >= 10);
+    int before = fired[s];
+    _run(50);
+    printf("interval fold: count:%d after 50ms more\n", fired[s]);
+    assert(fired[s] >= before + 8 && fired[s] <= before + 11);
+    assert(hive_timer_remove(T, s, HANDLE));
+}
+
+
+static void
+_test_cancel_in_dispatch() {
+    memset(fired, 0, sizeof(fired));
+    int s = hive_timer_insert(T, 2, 2, HANDLE);
+    cancel_session = s;
+    _run(40);
+    printf("cancel in dispatch: count:%d\n", fired[s]);
+    assert(fired[s] == 1);
+    assert(!hive_timer_remove(T, s, HANDLE));
+}
+
+
+int
+main(int argc, char const *argv[]) {
+    T = hive_timer_create(1, 1);
+    _test_insert_remove();
+    _test_level_wheel();
+    _test_interval_fold();
+    _test_cancel_in_dispatch();
+    hive_timer_free(T);
+    printf("timer test ok\n");
+    return 0;
+}